@@ -1,33 +1,271 @@
 #include "basic_file_system.h"
+#include "fs_stats.h"
+#include <string.h>
 
+static struct xsuperblock xsb;
+static int have_xsb = 0;
 
-int bfs_mount(const char* filename) {
-  // mount the raw disk
-  if (raw_mount(filename) < 0) {
+// the checksum table raw_disk.c is using (0 if none)
+static block_num_t checksum_table = 0;
+
+// extra references of each block beyond the one recorded in the bitmap, two
+// blocks per byte (only loaded when the image has a reference count table)
+static unsigned char refcounts[NUM_BLOCKS / 2];
+
+// the usage counters (see bfs_usage); counts_known is 0 until the number of
+// files and directories has been set
+static int free_blocks = 0;
+static int num_files = 0;
+static int num_dirs = 0;
+static int counts_known = 0;
+
+// while releases are deferred, the blocks that lost their last reference stay
+// allocated in the bitmap and are only marked here, until do_reclaim() clears
+// all of them with one bitmap update (a private mount only)
+static int defer_release = 0;
+static char pending[BLOCK_SIZE];
+static int num_pending = 0;
+
+
+// writes back the table block holding the reference count of the given block
+static int write_refcount(block_num_t block) {
+  int table_block = (block / 2) / BLOCK_SIZE;
+  return write_block(xsb.refcount_table[table_block], refcounts + table_block * BLOCK_SIZE);
+}
+
+
+// reads and writes of the allocation bitmap (the superblock) go through these
+static int read_bitmap(char* superblock) {
+  STATS_INC(bitmap_reads);
+  return read_block(0, superblock);
+}
+
+
+static int write_bitmap(char* superblock) {
+  STATS_INC(bitmap_writes);
+  return write_block(0, superblock);
+}
+
+
+static int extra_refs(block_num_t block) {
+  return (refcounts[block / 2] >> (4 * (block % 2))) & 0xf;
+}
+
+
+static void set_extra_refs(block_num_t block, int refs) {
+  refcounts[block / 2] &= ~(0xf << (4 * (block % 2)));
+  refcounts[block / 2] |= refs << (4 * (block % 2));
+}
+
+
+// counts the free blocks in the bitmap
+static int count_free(const char* superblock) {
+  int allocated = 0;
+  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
+    allocated += __builtin_popcount((unsigned char) superblock[byte]);
+  }
+  return NUM_BLOCKS - allocated;
+}
+
+
+// copies the usage counters to the extended superblock and writes it
+static int write_usage(int valid) {
+  if (!have_xsb) {
+    return 0;
+  }
+  xsb.counts_valid = valid;
+  xsb.free_blocks = free_blocks;
+  xsb.num_files = num_files;
+  xsb.num_dirs = num_dirs;
+  return write_block(XSB_BLOCK, &xsb);
+}
+
+
+// called after the counters change: processes sharing a mount read them from
+// the extended superblock, so it is written straight away; a private mount
+// only writes them at unmount
+static int usage_changed() {
+  return raw_is_shared() ? write_usage(counts_known) : 0;
+}
+
+
+// takes the counters from the extended superblock if they are valid, and
+// otherwise counts the free blocks in the bitmap
+static int load_usage(const char* superblock) {
+  if (have_xsb && xsb.counts_valid) {
+    free_blocks = xsb.free_blocks;
+    num_files = xsb.num_files;
+    num_dirs = xsb.num_dirs;
+    counts_known = 1;
+    return 0;
+  }
+  char bitmap[BLOCK_SIZE];
+  if (superblock == NULL) {
+    if (read_bitmap(bitmap) < 0) {
+      return -1;
+    }
+    superblock = bitmap;
+  }
+  free_blocks = count_free(superblock);
+  counts_known = 0;
+  return 0;
+}
+
+
+// points raw_disk.c at the checksum table recorded in the extended superblock
+static int use_checksums(int init) {
+  block_num_t table = (have_xsb && (xsb.features & BFS_FEATURE_CHECKSUMS)) ? xsb.checksum_table : 0;
+  if (table == checksum_table && !init) {
+    return 0;
+  }
+  checksum_table = table;
+  return raw_checksums(table, init);
+}
+
+
+// reloads the extended superblock and reference counts, which another
+// process may have changed if the mount is shared (called with block 0 locked)
+static int refresh_shared() {
+  if (!raw_is_shared()) {
+    return 0;
+  }
+  if (!have_xsb) {
+    return load_usage(NULL);
+  }
+  if (read_block(XSB_BLOCK, &xsb) < 0 || use_checksums(0) < 0 || load_usage(NULL) < 0) {
     return -1;
   }
+  if (xsb.refcount_table[0] != 0) {
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      if (read_block(xsb.refcount_table[i], refcounts + i * BLOCK_SIZE) < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+static int mount_disk() {
 
   // read the superblock
   char superblock[BLOCK_SIZE];
-  if (read_block(0, superblock) < 0) {
+  if (read_bitmap(superblock) < 0) {
     return -1;
   }
 
   // make sure the superblock and root directory are marked "allocated"
   if (!(superblock[0] & 3)) {
     superblock[0] |= 3;
-    if (write_block(0, superblock) < 0) {
+    if (write_bitmap(superblock) < 0) {
       return -1;
     }
   }
-  return 0;
+
+  // find the extended superblock, or claim its block if nothing else uses it
+  if (read_block(XSB_BLOCK, &xsb) < 0) {
+    return -1;
+  }
+  have_xsb = 1;
+  if (memcmp(xsb.magic, XSB_MAGIC, sizeof(xsb.magic)) != 0) {
+    int mask = 1 << (XSB_BLOCK % 8);
+    if (superblock[XSB_BLOCK / 8] & mask) {
+      have_xsb = 0;
+    } else {
+      memset(&xsb, 0, sizeof(xsb));
+      memcpy(xsb.magic, XSB_MAGIC, sizeof(xsb.magic));
+      superblock[XSB_BLOCK / 8] |= mask;
+      if (write_block(XSB_BLOCK, &xsb) < 0 || write_bitmap(superblock) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  // start checking checksums (the blocks read so far are not checked)
+  checksum_table = 0;
+  if (use_checksums(0) < 0) {
+    return -1;
+  }
+
+  // load the reference count table
+  memset(refcounts, 0, sizeof(refcounts));
+  if (have_xsb && xsb.refcount_table[0] != 0) {
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      if (read_block(xsb.refcount_table[i], refcounts + i * BLOCK_SIZE) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  defer_release = 0;
+  memset(pending, 0, sizeof(pending));
+  num_pending = 0;
+
+  // load the usage counters; a private mount marks them invalid on the disk
+  // until it is unmounted
+  if (load_usage(superblock) < 0) {
+    return -1;
+  }
+  return (raw_is_shared() || !counts_known) ? 0 : write_usage(0);
 }
 
 
-block_num_t allocate_block() {
+int bfs_mount(const char* filename) {
+  // mount the raw disk
+  if (raw_mount(filename) < 0) {
+    return -1;
+  }
+  return mount_disk();
+}
+
+
+int bfs_mount_shared(const char* filename) {
+  if (raw_mount_shared(filename) < 0) {
+    return -1;
+  }
+  // block 0's lock covers the bitmap, the extended superblock and the
+  // reference counts in every process
+  raw_lock_block(0);
+  int ret = mount_disk();
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+// gives the blocks whose release was deferred back to the bitmap
+static int do_reclaim() {
+  if (num_pending == 0) {
+    return 0;
+  }
+  char superblock[BLOCK_SIZE];
+  if (read_bitmap(superblock) < 0) {
+    return -1;
+  }
+  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
+    superblock[byte] &= ~pending[byte];
+  }
+  if (write_bitmap(superblock) < 0) {
+    return -1;
+  }
+  free_blocks += num_pending;
+  memset(pending, 0, sizeof(pending));
+  num_pending = 0;
+  return usage_changed();
+}
+
+
+static block_num_t do_allocate_block() {
+  // the deferred releases are done once they are the only free blocks left
+  if (free_blocks == 0 && do_reclaim() < 0) {
+    return 0;
+  }
+  if (free_blocks == 0) {
+    return 0; // no free blocks
+  }
+
   // read the superblock
   char superblock[BLOCK_SIZE];
-  if (read_block(0, superblock) < 0) {
+  if (read_bitmap(superblock) < 0) {
     return 0;
   }
 
@@ -54,32 +292,336 @@ block_num_t allocate_block() {
   superblock[byte] |= 1 << bit;
 
   // write the updated superblock back to disk
-  if (write_block(0, superblock) < 0) {
+  if (write_bitmap(superblock) < 0) {
     return 0;
   }
+  free_blocks--;
+  usage_changed();
   return byte * 8 + bit;
 }
 
 
-int release_block(block_num_t block) {
-  // read the superblock
+// allocates count consecutive blocks; returns the first one, or 0 if there is no such run
+static block_num_t do_allocate_run(int count) {
+  char superblock[BLOCK_SIZE];
+  if (do_reclaim() < 0 || count > free_blocks || read_bitmap(superblock) < 0) {
+    return 0;
+  }
+  int run = 0;
+  for (int block = 0; block < NUM_BLOCKS; block++) {
+    run = (superblock[block / 8] & (1 << (block % 8))) ? 0 : run + 1;
+    if (run == count) {
+      int first = block - count + 1;
+      for (int b = first; b <= block; b++) {
+        superblock[b / 8] |= 1 << (b % 8);
+      }
+      if (write_bitmap(superblock) < 0) {
+        return 0;
+      }
+      free_blocks -= count;
+      usage_changed();
+      return first;
+    }
+  }
+  return 0;
+}
+
+
+// releases count consecutive blocks that have no extra references
+static int release_run(block_num_t first, int count) {
   char superblock[BLOCK_SIZE];
-  if (read_block(0, superblock) < 0) {
+  if (read_bitmap(superblock) < 0) {
+    return -1;
+  }
+  for (int b = first; b < first + count; b++) {
+    superblock[b / 8] &= ~(1 << (b % 8));
+  }
+  if (write_bitmap(superblock) < 0) {
     return -1;
   }
+  free_blocks += count;
+  return usage_changed();
+}
+
+
+// releases one reference to each of count blocks, with at most one update of
+// the bitmap and one of each reference count table block that changes;
+// freed[i] (if freed isn't NULL) is set to 1 if blocks[i] lost its last reference
+static int do_release_blocks(const block_num_t* blocks, int count, char* freed) {
+  char superblock[BLOCK_SIZE];
+  int have_bitmap = 0;
+  int released = 0;
+  char table_changed[REFCOUNT_BLOCKS];
+  memset(table_changed, 0, sizeof(table_changed));
+  if (freed != NULL) {
+    memset(freed, 0, count);
+  }
 
-  // change bit corresponding to block num to 0
-  char mask = 1 << (block % 8);
-  superblock[block / 8] &= ~mask;
+  for (int i = 0; i < count; i++) {
+    block_num_t block = blocks[i];
+
+    // a shared block only loses one of its references
+    if (extra_refs(block) > 0) {
+      set_extra_refs(block, extra_refs(block) - 1);
+      table_changed[(block / 2) / BLOCK_SIZE] = 1;
+      continue;
+    }
+
+    // read the superblock (once)
+    if (!have_bitmap && read_bitmap(superblock) < 0) {
+      return -1;
+    }
+    have_bitmap = 1;
+
+    // change bit corresponding to block num to 0, or mark it for later
+    char mask = 1 << (block % 8);
+    if (!(superblock[block / 8] & mask) || (pending[block / 8] & mask)) {
+      continue; // not allocated
+    }
+    if (defer_release) {
+      pending[block / 8] |= mask;
+      num_pending++;
+    } else {
+      superblock[block / 8] &= ~mask;
+      released++;
+    }
+    if (freed != NULL) {
+      freed[i] = 1;
+    }
+  }
+
+  int ret = 0;
+  for (int t = 0; t < REFCOUNT_BLOCKS; t++) {
+    if (table_changed[t] && write_refcount(t * BLOCK_SIZE * 2) < 0) {
+      ret = -1;
+    }
+  }
 
   // write the updated superblock back to disk
-  if (write_block(0, superblock) < 0) {
+  if (released > 0) {
+    if (write_bitmap(superblock) < 0) {
+      return -1;
+    }
+    free_blocks += released;
+    ret |= usage_changed();
+  }
+  return ret;
+}
+
+
+static int do_ref_block(block_num_t block) {
+  if (!have_xsb || xsb.refcount_table[0] == 0 || block_refs(block) == 0
+      || block_refs(block) >= MAX_BLOCK_REFS) {
+    return -1;
+  }
+  set_extra_refs(block, extra_refs(block) + 1);
+  if (write_refcount(block) < 0) {
+    set_extra_refs(block, extra_refs(block) - 1);
     return -1;
   }
   return 0;
 }
 
 
+static int do_block_refs(block_num_t block) {
+  char superblock[BLOCK_SIZE];
+  if (read_bitmap(superblock) < 0) {
+    return 0;
+  }
+  if (!(superblock[block / 8] & (1 << (block % 8))) || (pending[block / 8] & (1 << (block % 8)))) {
+    return 0;
+  }
+  return 1 + extra_refs(block);
+}
+
+
+int bfs_features() {
+  return have_xsb ? xsb.features : 0;
+}
+
+
+static int do_bfs_set_features(int features) {
+  if (!have_xsb) {
+    return -1;
+  }
+
+  // dedup needs somewhere to keep the reference counts
+  if ((features & BFS_FEATURE_DEDUP) && xsb.refcount_table[0] == 0) {
+    block_num_t table[REFCOUNT_BLOCKS];
+    char zeros[BLOCK_SIZE];
+    memset(zeros, 0, BLOCK_SIZE);
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      table[i] = allocate_block();
+      if (table[i] == 0 || write_block(table[i], zeros) < 0) {
+        for (int j = (table[i] == 0) ? i - 1 : i; j >= 0; j--) {
+          release_block(table[j]);
+        }
+        return -1;
+      }
+    }
+    memset(refcounts, 0, sizeof(refcounts));
+    memcpy(xsb.refcount_table, table, sizeof(table));
+  }
+
+  // checksums need a table in one run of blocks; it is filled in from the
+  // contents of the disk, and only then is the feature recorded
+  int init = 0;
+  if ((features & BFS_FEATURE_CHECKSUMS) && xsb.checksum_table == 0) {
+    xsb.checksum_table = do_allocate_run(CHECKSUM_BLOCKS);
+    if (xsb.checksum_table == 0) {
+      return -1;
+    }
+    init = 1;
+  }
+  block_num_t old_table = 0;
+  if (!(features & BFS_FEATURE_CHECKSUMS) && xsb.checksum_table != 0) {
+    old_table = xsb.checksum_table;
+    xsb.checksum_table = 0;
+  }
+
+  // the reference count table is kept once it exists, since blocks may still be shared
+  xsb.features = features;
+  if (use_checksums(init) < 0) {
+    if (init) {
+      release_run(xsb.checksum_table, CHECKSUM_BLOCKS);
+      xsb.checksum_table = 0;
+      xsb.features &= ~BFS_FEATURE_CHECKSUMS;
+      use_checksums(0);
+    }
+    return -1;
+  }
+  if (write_block(XSB_BLOCK, &xsb) < 0) {
+    return -1;
+  }
+  return old_table != 0 ? release_run(old_table, CHECKSUM_BLOCKS) : 0;
+}
+
+
+// The public allocator functions hold block 0's lock while they run, so
+// processes sharing a mount update the bitmap and reference counts one at a time
+
+block_num_t allocate_block() {
+  raw_lock_block(0);
+  block_num_t ret = refresh_shared() < 0 ? 0 : do_allocate_block();
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+block_num_t allocate_run(int count) {
+  raw_lock_block(0);
+  block_num_t ret = refresh_shared() < 0 ? 0 : do_allocate_run(count);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int release_block(block_num_t block) {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? -1 : do_release_blocks(&block, 1, NULL);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int release_blocks(const block_num_t* blocks, int count, char* freed) {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? -1 : do_release_blocks(blocks, count, freed);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int bfs_defer_release(int enable) {
+  if (raw_is_shared()) {
+    return -1;
+  }
+  defer_release = enable;
+  return enable ? 0 : do_reclaim();
+}
+
+
+int bfs_reclaim() {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? -1 : do_reclaim();
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int ref_block(block_num_t block) {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? -1 : do_ref_block(block);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int block_refs(block_num_t block) {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? 0 : do_block_refs(block);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int bfs_set_features(int features) {
+  raw_lock_block(0);
+  int ret = refresh_shared() < 0 ? -1 : do_bfs_set_features(features);
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int bfs_usage(struct bfs_usage* usage) {
+  raw_lock_block(0);
+  refresh_shared();
+  usage->free_blocks = free_blocks + num_pending;
+  usage->num_files = num_files;
+  usage->num_dirs = num_dirs;
+  int ret = counts_known;
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int bfs_set_usage(int files, int dirs) {
+  raw_lock_block(0);
+  int ret = refresh_shared();
+  if (ret == 0) {
+    num_files = files;
+    num_dirs = dirs;
+    // on a shared mount without an extended superblock, the other
+    // processes' changes can't be followed
+    counts_known = have_xsb || !raw_is_shared();
+    ret = usage_changed();
+  }
+  raw_unlock_block(0);
+  return ret;
+}
+
+
+int bfs_adjust_usage(int files, int dirs) {
+  raw_lock_block(0);
+  int ret = refresh_shared();
+  if (ret == 0) {
+    num_files += files;
+    num_dirs += dirs;
+    ret = usage_changed();
+  }
+  raw_unlock_block(0);
+  return ret;
+}
+
+
 int bfs_unmount() {
+  do_reclaim();
+  // a private mount leaves valid counters behind (a shared one has kept them up to date)
+  if (!raw_is_shared() && counts_known) {
+    write_usage(1);
+  }
+  have_xsb = 0;
+  counts_known = 0;
+  checksum_table = 0;
   return raw_unmount();
 }
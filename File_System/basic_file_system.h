@@ -3,7 +3,46 @@
 
 #include "raw_disk.h"
 
+// The bitmap in the superblock (block 0) fills a whole block, so optional
+// features of the image are recorded in an extended superblock kept in the
+// last block of the disk.  It is claimed when the image is mounted, unless an
+// older image already uses that block for data (then no features are available).
+#define XSB_BLOCK (NUM_BLOCKS - 1)
+#define XSB_MAGIC "JFSX"
+
+// number of blocks in the reference count table (4 bits per disk block)
+#define REFCOUNT_BLOCKS (NUM_BLOCKS / 2 / BLOCK_SIZE)
+
+// largest number of references a block can have
+#define MAX_BLOCK_REFS 16
+
+// features that can be turned on for an image
+#define BFS_FEATURE_DEDUP 0x1 // identical full data blocks are shared between files
+#define BFS_FEATURE_CHECKSUMS 0x2 // every block has a CRC-32C that is checked when it is read
+
+struct xsuperblock {
+  char magic[4];     // XSB_MAGIC
+  uint16_t features; // BFS_FEATURE_*
+  block_num_t refcount_table[REFCOUNT_BLOCKS]; // 0 if the image has no table
+  block_num_t checksum_table; // first of CHECKSUM_BLOCKS consecutive blocks, 0 if none
+  // the usage counters; they are only trusted if counts_valid is 1, and it is
+  // 0 while the image is mounted privately (so that they are counted again
+  // if it is not unmounted cleanly)
+  uint16_t counts_valid;
+  uint16_t free_blocks;
+  uint16_t num_files;
+  uint16_t num_dirs;
+};
+
+// what bfs_usage() reports
+struct bfs_usage {
+  uint16_t free_blocks;
+  uint16_t num_files;
+  uint16_t num_dirs;
+};
+
 int bfs_mount(const char* filename);
+int bfs_mount_shared(const char* filename); // see raw_mount_shared()
 
 /* allocate_block
  *   allocates a new block - finds a block that not yet allocated, marks it as
@@ -16,6 +55,13 @@ int bfs_mount(const char* filename);
  */
 block_num_t allocate_block();
 
+/* allocate_run
+ *   allocates count consecutive blocks (the first run of free blocks that is
+ *   long enough)
+ * returns the number of the first block, or 0 if there is no such run
+ */
+block_num_t allocate_run(int count);
+
 /* release_block
  *   releases the specified disk block, allowing it to be allocated again by
  *   allocate_block() sometime in the future
@@ -27,6 +73,72 @@ block_num_t allocate_block();
  */
 int release_block(block_num_t block);
 
+/* release_blocks
+ *   releases count blocks like calling release_block() for each of them, but
+ *   reads and writes the bitmap only once (bulk deletes take one bitmap
+ *   update instead of one per block)
+ * freed - if not NULL, freed[i] is set to 1 if blocks[i] lost its last
+ *   reference (so it is free now, or will be at the next bfs_reclaim())
+ * returns 0 on success and -1 on failure
+ */
+int release_blocks(const block_num_t* blocks, int count, char* freed);
+
+/* bfs_defer_release / bfs_reclaim
+ *   while deferring is on, blocks that lose their last reference stay marked
+ *   allocated in the bitmap, and all of them are given back at once by
+ *   bfs_reclaim(), which also happens at unmount, when turning deferring off
+ *   and when the allocator runs out of other free blocks (they count as free
+ *   in bfs_usage(), but not for block_refs())
+ * returns 0 on success, or -1 on failure (deferring is not available on a
+ *   shared mount)
+ */
+int bfs_defer_release(int enable);
+int bfs_reclaim();
+
+/* ref_block
+ *   adds a reference to an allocated block, so that it is only released once
+ *   release_block() has been called once for every reference
+ * block - number of the block
+ * returns 0 on success, or -1 if the image has no reference count table, the
+ *   block is not allocated or it already has MAX_BLOCK_REFS references
+ */
+int ref_block(block_num_t block);
+
+/* block_refs
+ *   returns the number of references to a block (0 if it is free)
+ */
+int block_refs(block_num_t block);
+
+/* bfs_features / bfs_set_features
+ *   get and set the BFS_FEATURE_* flags of the mounted image; turning on
+ *   BFS_FEATURE_DEDUP allocates the reference count table if there isn't one,
+ *   and turning on BFS_FEATURE_CHECKSUMS allocates the checksum table (a run
+ *   of consecutive blocks, which is released again when it is turned off)
+ * bfs_set_features returns 0 on success, or -1 if the image has no extended
+ *   superblock or a table could not be allocated
+ */
+int bfs_features();
+int bfs_set_features(int features);
+
+/* bfs_usage
+ *   gets the number of free blocks, files and directories of the mounted
+ *   image; they are kept up to date as blocks are allocated and released,
+ *   so nothing is scanned
+ * usage - pointer to a struct bfs_usage (already allocated by the caller)
+ * returns 1, or 0 if the number of files and directories is not known (the
+ *   image was not unmounted cleanly or has no extended superblock); they
+ *   then have to be counted and set with bfs_set_usage()
+ */
+int bfs_usage(struct bfs_usage* usage);
+
+/* bfs_set_usage / bfs_adjust_usage
+ *   set the number of files and directories, or add to them (the file system
+ *   above calls bfs_adjust_usage() whenever it creates or removes one)
+ * returns 0 on success or -1 on failure
+ */
+int bfs_set_usage(int num_files, int num_dirs);
+int bfs_adjust_usage(int files, int dirs);
+
 int bfs_unmount();
 
 #endif // _BASIC_FILE_SYSTEM_H_
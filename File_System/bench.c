@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jumbo_file_system.h"
+#include "fs_stats.h"
+#include "crc32c.h"
+
+#define BENCH_DISK "BENCH_DISK"
+#define MAX_SAMPLES 100000
+
+// workload parameters (set from the command line)
+static int num_ops = 200;      // operations per workload (where it has a choice)
+static int append_size = 32;   // bytes per jfs_write in the append workload
+static int repeat = 20;        // passes over the files in the read and ls workloads
+static const char* disk_name = BENCH_DISK;
+static int sync_mode = JFS_SYNC_NONE;
+static int sync_ms = 0;
+
+// latency of every timed call of the current workload
+static uint64_t samples[MAX_SAMPLES];
+static int num_samples;
+static uint64_t run_start;
+static struct fs_stats io_start;
+
+
+static void fresh_image() {
+  raw_remove(disk_name);
+  if (jfs_mount(disk_name) < 0) {
+    perror("jfs_bench: cannot create the image");
+    exit(1);
+  }
+  jfs_durability(sync_mode, sync_ms);
+}
+
+
+static void begin_workload() {
+  num_samples = 0;
+  stats_reset();
+  stats_get(&io_start);
+  run_start = stats_now_ns();
+}
+
+
+// records the latency of the call that just returned (started at sample_start)
+static uint64_t sample_start;
+
+static int record_sample(int ret) {
+  if (num_samples < MAX_SAMPLES) {
+    samples[num_samples++] = stats_now_ns() - sample_start;
+  }
+  return ret;
+}
+
+// times one call; evaluates to the call's return value
+#define TIMED(call) (sample_start = stats_now_ns(), record_sample(call))
+
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+
+// prints one JSON line with the results of the workload that just finished
+static void end_workload(const char* name) {
+  uint64_t elapsed = stats_now_ns() - run_start;
+  struct fs_stats io;
+  stats_get(&io);
+  qsort(samples, num_samples, sizeof(samples[0]), compare_u64);
+  double ops = num_samples ? num_samples : 1;
+  printf("{\"workload\":\"%s\",\"ops\":%d,\"ops_per_sec\":%.0f,"
+         "\"p50_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu,"
+         "\"block_reads_per_op\":%.2f,\"block_writes_per_op\":%.2f,\"bitmap_ios_per_op\":%.2f,"
+         "\"flushes_per_op\":%.2f}\n",
+         name, num_samples, num_samples / (elapsed / 1e9),
+         num_samples ? (unsigned long) samples[num_samples / 2] : 0,
+         num_samples ? (unsigned long) samples[(num_samples * 99) / 100] : 0,
+         num_samples ? (unsigned long) samples[num_samples - 1] : 0,
+         (io.block_reads - io_start.block_reads) / ops,
+         (io.block_writes - io_start.block_writes) / ops,
+         (io.bitmap_reads + io.bitmap_writes - io_start.bitmap_reads - io_start.bitmap_writes) / ops,
+         (io.flushes - io_start.flushes) / ops);
+  fflush(stdout);
+}
+
+
+// Directories hold only MAX_DIR_ENTRIES entries, so the storms lay files out
+// as a chain: every directory gets one subdirectory "d" and the rest files.
+#define FILES_PER_DIR (MAX_DIR_ENTRIES - 1)
+
+static void file_name(int i, char* name) {
+  snprintf(name, MAX_NAME_LENGTH + 1, "f%d", i % (int) FILES_PER_DIR);
+}
+
+
+// creates n files along the chain (untimed unless timed is set); returns how many were made
+static int make_files(int n, int timed) {
+  jfs_chdir(NULL);
+  int i;
+  for (i = 0; i < n; i++) {
+    char name[MAX_NAME_LENGTH + 1];
+    if (i > 0 && i % FILES_PER_DIR == 0 && jfs_chdir("d") != E_SUCCESS) {
+      break;
+    }
+    if (i % FILES_PER_DIR == 0 && jfs_mkdir("d") != E_SUCCESS) {
+      break;
+    }
+    file_name(i, name);
+    if ((timed ? TIMED(jfs_creat(name)) : jfs_creat(name)) != E_SUCCESS) {
+      break;
+    }
+  }
+  jfs_chdir(NULL);
+  return i;
+}
+
+
+static void bench_mkdir() {
+  // breadth-first: fill a directory, then descend into its first child
+  begin_workload();
+  jfs_chdir(NULL);
+  for (int done = 0; done < num_ops; ) {
+    int made = 0;
+    for (int k = 0; k < (int) MAX_DIR_ENTRIES && done < num_ops; k++, done++) {
+      char name[16];
+      snprintf(name, sizeof(name), "d%d", k);
+      if (TIMED(jfs_mkdir(name)) != E_SUCCESS) {
+        done = num_ops;
+        break;
+      }
+      made++;
+    }
+    if (made == 0 || jfs_chdir("d0") != E_SUCCESS) {
+      break;
+    }
+  }
+  end_workload("mkdir");
+}
+
+
+static void bench_creat() {
+  begin_workload();
+  make_files(num_ops, 1);
+  end_workload("creat");
+}
+
+
+static void bench_append() {
+  char* data = malloc(append_size);
+  for (int i = 0; i < append_size; i++) {
+    data[i] = 'a' + i % 26;
+  }
+  jfs_chdir(NULL);
+  jfs_creat("f0");
+  begin_workload();
+  // append to f0, f1, ... in the root until num_ops writes are done
+  for (int i = 0, f = 0; i < num_ops; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "f%d", f);
+    int ret = TIMED(jfs_write(name, data, append_size));
+    if (ret == E_MAX_FILE_SIZE && f + 1 < (int) MAX_DIR_ENTRIES) {
+      num_samples--;
+      f++;
+      snprintf(name, sizeof(name), "f%d", f);
+      jfs_creat(name);
+      i--;
+    } else if (ret != E_SUCCESS) {
+      break;
+    }
+  }
+  end_workload("append");
+  free(data);
+}
+
+
+// The append_interleaved workloads append to all the files of the root
+// directory in turn, as concurrent log writers would; with prealloc set every
+// file first reserves its full size with jfs_fallocate (untimed), so the
+// appends don't allocate and every file stays in one run of blocks.  The
+// runs of each file's blocks are counted at the end (1 per file is ideal).
+static void append_interleaved(int prealloc, const char* workload) {
+  char* data = malloc(append_size);
+  memset(data, 'l', append_size);
+  int files = MAX_DIR_ENTRIES;
+  int per_file = num_ops / files;
+  if (per_file * append_size > (int) MAX_FILE_SIZE) {
+    per_file = MAX_FILE_SIZE / append_size;
+  }
+  jfs_chdir(NULL);
+  for (int f = 0; f < files; f++) {
+    char name[16];
+    snprintf(name, sizeof(name), "f%d", f);
+    jfs_creat(name);
+    if (prealloc) {
+      jfs_fallocate(name, per_file * append_size);
+    }
+  }
+  begin_workload();
+  for (int i = 0; i < per_file; i++) {
+    for (int f = 0; f < files; f++) {
+      char name[16];
+      snprintf(name, sizeof(name), "f%d", f);
+      TIMED(jfs_write(name, data, append_size));
+    }
+  }
+  end_workload(workload);
+
+  int runs = 0;
+  for (int f = 0; f < files; f++) {
+    char name[16];
+    struct stats st;
+    struct block inode;
+    snprintf(name, sizeof(name), "f%d", f);
+    jfs_stat(name, &st);
+    read_block(st.block_num, &inode);
+    for (uint32_t k = 0; k < st.num_data_blocks; k++) {
+      runs += k == 0 || inode.contents.inode.data_blocks[k] != inode.contents.inode.data_blocks[k - 1] + 1;
+    }
+  }
+  printf("{\"workload\":\"%s_layout\",\"files\":%d,\"block_runs\":%d}\n", workload, files, runs);
+  free(data);
+}
+
+
+static void bench_append_interleaved() {
+  append_interleaved(0, "append_interleaved");
+}
+
+
+static void bench_append_prealloc() {
+  append_interleaved(1, "append_prealloc");
+}
+
+
+// fills the files of the root directory so the read workloads have data
+static int fill_files(char data[MAX_FILE_SIZE]) {
+  memset(data, 'x', MAX_FILE_SIZE);
+  int n;
+  for (n = 0; n < (int) MAX_DIR_ENTRIES; n++) {
+    char name[16];
+    snprintf(name, sizeof(name), "f%d", n);
+    if (jfs_creat(name) != E_SUCCESS || jfs_write(name, data, MAX_FILE_SIZE) != E_SUCCESS) {
+      break;
+    }
+  }
+  return n;
+}
+
+
+static void read_files(int n, int passes, char data[MAX_FILE_SIZE]) {
+  for (int p = 0; p < passes; p++) {
+    for (int i = 0; i < n; i++) {
+      char name[16];
+      unsigned short count = MAX_FILE_SIZE;
+      snprintf(name, sizeof(name), "f%d", i);
+      TIMED(jfs_read(name, data, &count));
+    }
+  }
+}
+
+
+// mounts the image again with nothing of it cached, neither by the file
+// system nor by the host (a ram: image doesn't outlive its mount, and has no
+// cold reads anyway)
+static void remount_cold() {
+  if (0 == strncmp(disk_name, "ram:", 4)) {
+    return;
+  }
+  jfs_unmount();
+  if (raw_uncache(disk_name) < 0) {
+    perror("jfs_bench: cannot drop the cached image");
+  }
+  jfs_mount(disk_name);
+  jfs_durability(sync_mode, sync_ms);
+}
+
+
+static void bench_read() {
+  char data[MAX_FILE_SIZE];
+  int n = fill_files(data);
+
+  // cold: the first read of every file right after mounting
+  remount_cold();
+  begin_workload();
+  read_files(n, 1, data);
+  end_workload("read_cold");
+
+  begin_workload();
+  read_files(n, repeat, data);
+  end_workload("read_warm");
+}
+
+
+// prints the throughput of one CRC-32C implementation over block-sized buffers
+static void crc_throughput(const char* name, uint32_t (*crc_fn)(uint32_t, const void*, size_t)) {
+  char block[BLOCK_SIZE];
+  memset(block, 'c', BLOCK_SIZE);
+  long blocks = (long) num_ops * 1000;
+  volatile uint32_t sink = 0;
+  uint64_t start = stats_now_ns();
+  for (long i = 0; i < blocks; i++) {
+    block[i % BLOCK_SIZE]++;
+    sink ^= crc_fn(0, block, BLOCK_SIZE);
+  }
+  uint64_t elapsed = stats_now_ns() - start;
+  printf("{\"workload\":\"%s\",\"blocks\":%ld,\"ns_per_block\":%.1f,\"mb_per_sec\":%.0f}\n",
+         name, blocks, (double) elapsed / blocks, blocks * BLOCK_SIZE / (elapsed / 1e9) / 1e6);
+  (void) sink;
+}
+
+
+static void bench_crc() {
+  // the raw checksum cost per block...
+  if (crc32c_hw_available()) {
+    crc_throughput("crc_sse42", crc32c);
+  }
+  crc_throughput("crc_table", crc32c_sw);
+
+  // ...and what it adds to reads from the disk (compare with read_cold and read_warm)
+  char data[MAX_FILE_SIZE];
+  if (jfs_checksums(1) != E_SUCCESS) {
+    fprintf(stderr, "jfs_bench: cannot turn on checksums\n");
+    return;
+  }
+  int n = fill_files(data);
+  remount_cold();
+  begin_workload();
+  read_files(n, 1, data);
+  end_workload("read_cold_checksummed");
+
+  begin_workload();
+  read_files(n, repeat, data);
+  end_workload("read_warm_checksummed");
+}
+
+
+static void bench_ls() {
+  make_files(FILES_PER_DIR, 0);
+  begin_workload();
+  for (int i = 0; i < num_ops; i++) {
+    char* directories[MAX_DIR_ENTRIES + 1];
+    char* files[MAX_DIR_ENTRIES + 1];
+    TIMED(jfs_ls(directories, files));
+    for (int k = 0; directories[k] != NULL; k++) {
+      free(directories[k]);
+    }
+    for (int k = 0; files[k] != NULL; k++) {
+      free(files[k]);
+    }
+  }
+  end_workload("ls");
+}
+
+
+static void bench_remove() {
+  int n = make_files(num_ops, 0);
+  begin_workload();
+  jfs_chdir(NULL);
+  for (int i = 0; i < n; i++) {
+    char name[MAX_NAME_LENGTH + 1];
+    if (i > 0 && i % FILES_PER_DIR == 0) {
+      jfs_chdir("d");
+    }
+    file_name(i, name);
+    TIMED(jfs_remove(name));
+  }
+  end_workload("remove");
+}
+
+
+// The remove_full workloads remove files of this many data blocks (as many of
+// them as fit on the image), releasing the blocks straight away or deferred;
+// the deferred run includes the final reclaim.
+#define FULL_BLOCKS 8
+
+static void remove_full(int deferred, const char* workload) {
+  char data[FULL_BLOCKS * BLOCK_SIZE];
+  memset(data, 'x', sizeof(data));
+  struct jfs_statfs fs;
+  jfs_statfs(&fs);
+  int fit = fs.free_blocks / (FULL_BLOCKS + 2);
+  int n = make_files(num_ops < fit ? num_ops : fit, 0);
+  for (int i = 0; i < n; i++) {
+    char name[MAX_NAME_LENGTH + 1];
+    if (i > 0 && i % FILES_PER_DIR == 0) {
+      jfs_chdir("d");
+    }
+    file_name(i, name);
+    jfs_write(name, data, sizeof(data));
+  }
+
+  begin_workload();
+  jfs_chdir(NULL);
+  jfs_defer_release(deferred);
+  for (int i = 0; i < n; i++) {
+    char name[MAX_NAME_LENGTH + 1];
+    if (i > 0 && i % FILES_PER_DIR == 0) {
+      jfs_chdir("d");
+    }
+    file_name(i, name);
+    TIMED(jfs_remove(name));
+  }
+  jfs_defer_release(0);
+  end_workload(workload);
+}
+
+
+static void bench_remove_full() {
+  remove_full(0, "remove_full");
+}
+
+
+static void bench_remove_full_deferred() {
+  remove_full(1, "remove_full_deferred");
+}
+
+
+static const struct {
+  const char* name;
+  void (*run)();
+} workloads[] = {
+  {"mkdir", bench_mkdir},
+  {"creat", bench_creat},
+  {"append", bench_append},
+  {"append_interleaved", bench_append_interleaved},
+  {"append_prealloc", bench_append_prealloc},
+  {"read", bench_read},
+  {"ls", bench_ls},
+  {"remove", bench_remove},
+  {"remove_full", bench_remove_full},
+  {"remove_full_deferred", bench_remove_full_deferred},
+  {"crc", bench_crc},
+};
+
+#define NUM_WORKLOADS ((int) (sizeof(workloads) / sizeof(workloads[0])))
+
+
+static void usage() {
+  fprintf(stderr, "usage: jfs_bench [-n ops] [-s append_size] [-r repeat] [-d disk] [-y none|op|ms] [workload ...]\n");
+  fprintf(stderr, "the disk can be ram:, hdd:file, ssd:file, direct:file or stripe:unit:file,file,... (see disk_backend.h)\n");
+  fprintf(stderr, "workloads:");
+  for (int i = 0; i < NUM_WORKLOADS; i++) {
+    fprintf(stderr, " %s", workloads[i].name);
+  }
+  fprintf(stderr, " (default: all)\n");
+  exit(2);
+}
+
+
+static void run_workload(int i) {
+  fresh_image();
+  stats_enable(1);
+  workloads[i].run();
+  stats_enable(0);
+  jfs_unmount();
+}
+
+
+int main(int argc, char* argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:r:d:y:")) != -1) {
+    switch (opt) {
+    case 'n':
+      num_ops = atoi(optarg);
+      break;
+    case 's':
+      append_size = atoi(optarg);
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 'd':
+      disk_name = optarg;
+      break;
+    case 'y':
+      // the durability mode the workloads run in (see jfs_durability)
+      sync_mode = 0 == strcmp(optarg, "op") ? JFS_SYNC_OP
+                : 0 == strcmp(optarg, "none") ? JFS_SYNC_NONE : JFS_SYNC_PERIODIC;
+      sync_ms = atoi(optarg);
+      if (sync_mode == JFS_SYNC_PERIODIC && sync_ms <= 0) {
+        usage();
+      }
+      break;
+    default:
+      usage();
+    }
+  }
+  if (num_ops <= 0 || append_size <= 0 || append_size > (int) MAX_FILE_SIZE || repeat <= 0) {
+    usage();
+  }
+
+  if (optind == argc) {
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+      run_workload(i);
+    }
+  }
+  for (int a = optind; a < argc; a++) {
+    int i;
+    for (i = 0; i < NUM_WORKLOADS && 0 != strcmp(argv[a], workloads[i].name); i++) {}
+    if (i == NUM_WORKLOADS) {
+      usage();
+    }
+    run_workload(i);
+  }
+  raw_remove(disk_name);
+  return 0;
+}
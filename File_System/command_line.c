@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "jumbo_file_system.h"
+#include "fs_stats.h"
+#include "trace.h"
 
 #define DISK_FILENAME "DISK"
 #define MAX_CMD_LENGTH 2048
@@ -10,7 +12,10 @@
 #define WHITESPACE_DELIM " \t\r\n"
 
 
-void print_error(int err, const char* name) {
+/* print_error
+ *   prints a message for a jfs_* error code and returns the code
+ */
+int print_error(int err, const char* name) {
     switch (err) {
     case E_SUCCESS:
       break; // do nothing
@@ -41,31 +46,43 @@ void print_error(int err, const char* name) {
     case E_DISK_FULL:
       printf("disk is full");
       break;
+    case E_INVALID:
+      printf("invalid operation on %s\n", name);
+      break;
     case E_UNKNOWN:
       printf("an unknown error occurred\n");
       break;
     default:
       printf("an unrecognized error (%d) occurred\n", err);
     }
+    return err;
 }
 
 
 /* run_command
  *   Runs one entire command line, which may include multiple pipeline stages
  */
-void run_command(char* command_line) {
+int run_command(char* command_line) {
   /* Parse the arguments */
+  int status = 0;
   char* saveptr = NULL; /* used internally by strtok_r */
   char* tokens[MAX_ARGS + 2]; // +1 for the command itself, +1 for a NULL
   memset(tokens, 0, sizeof(tokens));
   tokens[0] = strtok_r(command_line, WHITESPACE_DELIM, &saveptr);
   for (int i = 1; tokens[i-1] != NULL && i < (MAX_ARGS+2); ++i) {
+    if (i == MAX_ARGS && 0 == strcmp(tokens[0], "append")) {
+      // the data to append is the rest of the line, spaces and all
+      char* data = saveptr + strspn(saveptr, " \t");
+      data[strcspn(data, "\r\n")] = '\0';
+      tokens[i] = ('\0' == *data) ? NULL : data;
+      break;
+    }
     tokens[i] = strtok_r(NULL, WHITESPACE_DELIM, &saveptr);
   }
   if (NULL != tokens[MAX_ARGS+1]) {
     /* overwrote NULL => too many args error */
     fprintf(stderr, "ERROR: too many arguments on the command line\n");
-    return;
+    return 1;
   }
 
   if (NULL == tokens[0]) {
@@ -74,39 +91,39 @@ void run_command(char* command_line) {
   } else if (0 == strcmp(tokens[0], "cd")) {
     if (NULL != tokens[2]) {
       fprintf(stderr, "usage: cd [dir_name]\n(dir_name is optional; leaving it out will return to the root directory)\n");
-      return;
+      return 1;
     }
 
     // Note: tokens[1] == NULL is valid; this should return to the root directory
     int ret = jfs_chdir(tokens[1]);
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "mkdir")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: mkdir <dir_name>\n");
-      return;
+      return 1;
     }
     int ret = jfs_mkdir(tokens[1]);
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "rmdir")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: rmdir <dir_name>\n");
-      return;
+      return 1;
     }
     int ret = jfs_rmdir(tokens[1]);
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "ls")) {
     if (NULL != tokens[1]) {
       fprintf(stderr, "usage: ls\n");
-      return;
+      return 1;
     }
 
-    char* directories[MAX_DIR_ENTRIES];
-    char* files[MAX_DIR_ENTRIES];
-    memset(directories, -1, MAX_DIR_ENTRIES * sizeof(const char*));
-    memset(files,       -1, MAX_DIR_ENTRIES * sizeof(const char*));
+    char* directories[MAX_DIR_ENTRIES + 1];
+    char* files[MAX_DIR_ENTRIES + 1];
+    memset(directories, -1, (MAX_DIR_ENTRIES + 1) * sizeof(const char*));
+    memset(files,       -1, (MAX_DIR_ENTRIES + 1) * sizeof(const char*));
     int ret = jfs_ls(directories, files);
 
     if (E_SUCCESS == ret) {
@@ -120,28 +137,29 @@ void run_command(char* command_line) {
       }
     } else {
       printf("ls failed - but ls should never fail!\n");
+      status = 1;
     }
 
   } else if (0 == strcmp(tokens[0], "touch")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: touch <file_name>\n");
-      return;
+      return 1;
     }
     int ret = jfs_creat(tokens[1]);
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "rm")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: rm <file_name>\n");
-      return;
+      return 1;
     }
     int ret = jfs_remove(tokens[1]);
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "stat")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: stat <file_name>\n");
-      return;
+      return 1;
     }
 
     struct stats file_stats;
@@ -158,15 +176,17 @@ void run_command(char* command_line) {
         printf("Inode block number: %u\n", file_stats.block_num);
         printf("Number of data blocks: %u\n", file_stats.num_data_blocks);
         printf("File size: %u\n", file_stats.file_size);
+        printf("Compressed: %s\n", (file_stats.flags & JFS_COMPRESSED) ? "yes" : "no");
+        printf("Preallocated blocks: %u\n", file_stats.reserved_blocks);
       }
     } else {
-      print_error(ret, tokens[1]);
+      status = print_error(ret, tokens[1]);
     }
 
   } else if (0 == strcmp(tokens[0], "cat")) {
     if (NULL == tokens[1] || NULL != tokens[2]) {
       fprintf(stderr, "usage: cat <file_name>\n");
-      return;
+      return 1;
     }
 
     unsigned short bytes_read = MAX_FILE_SIZE;
@@ -175,27 +195,129 @@ void run_command(char* command_line) {
     int ret = jfs_read(tokens[1], file_data, &bytes_read);
 
     if (E_SUCCESS == ret) {
-      ret = write(STDOUT_FILENO, file_data, bytes_read);
+      // through stdio, so the data stays in order with the rest of the (possibly buffered) output
+      ret = fwrite(file_data, 1, bytes_read, stdout);
       printf("\n");
       if (ret != bytes_read) {
         perror("Failed to write file data to stdout");
       }
     } else {
-      print_error(ret, tokens[1]);
+      status = print_error(ret, tokens[1]);
     }
 
   } else if (0 == strcmp(tokens[0], "append")) {
     if (NULL == tokens[1] || NULL == tokens[2]) {
       fprintf(stderr, "usage: append <file_name> <data>\n");
-      return;
+      return 1;
     }
 
     int ret = jfs_write(tokens[1], tokens[2], strlen(tokens[2]));
-    print_error(ret, tokens[1]);
+    status = print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "mv")) {
+    if (NULL == tokens[1] || NULL == tokens[2]) {
+      fprintf(stderr, "usage: mv <path> <new_path>\n");
+      return 1;
+    }
+    int ret = jfs_rename(tokens[1], tokens[2]);
+    status = print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "fallocate")) {
+    char* end = NULL;
+    long size = NULL == tokens[2] ? -1 : strtol(tokens[2], &end, 10);
+    if (NULL == tokens[1] || size < 0 || end == tokens[2] || '\0' != *end) {
+      fprintf(stderr, "usage: fallocate <file_name> <size>\n(size is a number of bytes)\n");
+      return 1;
+    }
+    // anything too large (even past LONG_MAX) is left to jfs_fallocate to refuse
+    int ret = jfs_fallocate(tokens[1], size > (long) MAX_FILE_SIZE ? (int) MAX_FILE_SIZE + 1 : (int) size);
+    status = print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "compress")) {
+    if (NULL == tokens[1] || NULL == tokens[2]
+        || (0 != strcmp(tokens[2], "on") && 0 != strcmp(tokens[2], "off"))) {
+      fprintf(stderr, "usage: compress <file_name> <on|off>\n");
+      return 1;
+    }
+    int ret = jfs_compress(tokens[1], 0 == strcmp(tokens[2], "on"));
+    status = print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "dedup")) {
+    if (NULL != tokens[1] && (NULL != tokens[2]
+        || (0 != strcmp(tokens[1], "on") && 0 != strcmp(tokens[1], "off")))) {
+      fprintf(stderr, "usage: dedup [on|off]\n(leaving out on/off prints the dedup statistics)\n");
+      return 1;
+    }
+    if (NULL != tokens[1]) {
+      int ret = jfs_dedup(0 == strcmp(tokens[1], "on"));
+      return status = print_error(ret, tokens[1]);
+    }
+
+    struct dedup_stats stats;
+    jfs_dedup_stats(&stats);
+    printf("Indexed blocks: %u\n", stats.indexed);
+    printf("References: %u\n", stats.references);
+    printf("Dedup ratio: %.2f\n", stats.indexed ? (double) stats.references / stats.indexed : 1.0);
+    printf("Lookups: %u (%u hits, %u probes, %u verify reads)\n",
+           stats.lookups, stats.hits, stats.probes, stats.verify_reads);
+    printf("Lookup time: %.1f us total, %.0f ns per lookup\n", stats.lookup_ns / 1000.0,
+           stats.lookups ? (double) stats.lookup_ns / stats.lookups : 0.0);
+
+  } else if (0 == strcmp(tokens[0], "checksum")) {
+    if (NULL != tokens[1] && (NULL != tokens[2]
+        || (0 != strcmp(tokens[1], "on") && 0 != strcmp(tokens[1], "off")))) {
+      fprintf(stderr, "usage: checksum [on|off]\n(leaving out on/off shows whether checksums are on)\n");
+      return 1;
+    }
+    if (NULL != tokens[1]) {
+      int ret = jfs_checksums(0 == strcmp(tokens[1], "on"));
+      return status = print_error(ret, tokens[1]);
+    }
+    printf("Checksums: %s\n", (bfs_features() & BFS_FEATURE_CHECKSUMS) ? "on" : "off");
+
+  } else if (0 == strcmp(tokens[0], "defer")) {
+    if (NULL == tokens[1] || NULL != tokens[2]
+        || (0 != strcmp(tokens[1], "on") && 0 != strcmp(tokens[1], "off"))) {
+      fprintf(stderr, "usage: defer <on|off>\n(on: removed files' blocks are given back at the next sync)\n");
+      return 1;
+    }
+    int ret = jfs_defer_release(0 == strcmp(tokens[1], "on"));
+    status = print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "df")) {
+    struct jfs_statfs fs;
+    jfs_statfs(&fs);
+    uint32_t used = fs.total_blocks - fs.free_blocks;
+    printf("Blocks: %u of %u bytes\n", fs.total_blocks, fs.block_size);
+    printf("Used: %u blocks (%u bytes)\n", used, used * fs.block_size);
+    printf("Free: %u blocks (%u bytes, %.1f%%)\n", fs.free_blocks, fs.free_blocks * fs.block_size,
+           100.0 * fs.free_blocks / fs.total_blocks);
+    printf("Files: %u\n", fs.num_files);
+    printf("Directories: %u\n", fs.num_dirs);
+
+  } else if (0 == strcmp(tokens[0], "sync")) {
+    int ret = jfs_sync();
+    status = print_error(ret, tokens[0]);
+
+  } else if (0 == strcmp(tokens[0], "fsstats")) {
+    if (NULL != tokens[1] && (NULL != tokens[2] || (0 != strcmp(tokens[1], "on")
+        && 0 != strcmp(tokens[1], "off") && 0 != strcmp(tokens[1], "reset")))) {
+      fprintf(stderr, "usage: fsstats [on|off|reset]\n(leaving out the argument prints the statistics as JSON)\n");
+      return 1;
+    }
+    if (NULL == tokens[1]) {
+      stats_print_json(stdout);
+    } else if (0 == strcmp(tokens[1], "reset")) {
+      stats_reset();
+    } else {
+      stats_enable(0 == strcmp(tokens[1], "on"));
+    }
 
   } else {
     fprintf(stderr, "ERROR: unrecognized command\n");
+    status = 1;
   }
+  return status;
 }
 
 
@@ -230,9 +352,120 @@ void prompt_for_input(char* input_buffer, int buflen) {
 
 
 
+/* run_batch
+ *   Runs every line of a script without prompting; output is fully buffered.
+ *   Lines starting with '#' are comments.  With stop_on_error the script
+ *   stops at the first command that fails, and with transaction the whole
+ *   script runs inside jfs_begin()/jfs_commit(), so the blocks it changes
+ *   are written to the DISK file once at the end.
+ *   Returns 0 if every command succeeded, or 1 otherwise.
+ */
+int run_batch(FILE* script, int stop_on_error, int transaction) {
+  static char output_buffer[1 << 16];
+  setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
 
-int main() {
+  if (transaction && E_SUCCESS != jfs_begin()) {
+    fprintf(stderr, "ERROR: could not start a transaction\n");
+    return 1;
+  }
+
+  int status = 0;
+  char* line = NULL; // getline grows it as needed, so lines have no length limit
+  size_t line_size = 0;
+  for (long line_num = 1; -1 != getline(&line, &line_size, script); line_num++) {
+    if ('#' == line[0]) {
+      continue;
+    }
+    if (0 == strcmp(line, "exit\n") || 0 == strcmp(line, "exit")) {
+      break;
+    }
+    if (0 != run_command(line)) {
+      status = 1;
+      if (stop_on_error) {
+        fflush(stdout);
+        fprintf(stderr, "ERROR: stopped at line %ld\n", line_num);
+        break;
+      }
+    }
+  }
+  free(line);
+
+  if (transaction && E_SUCCESS != jfs_commit()) {
+    fprintf(stderr, "ERROR: could not write the transaction to disk\n");
+    status = 1;
+  }
+  fflush(stdout);
+  return status;
+}
+
+
+void usage() {
+  fprintf(stderr, "usage: command_line [-b | -f script] [-e] [-t] [-s] [-y none|op|ms] [-T trace]\n");
+  fprintf(stderr, "  -b         run the commands read from stdin as a batch (no prompt)\n");
+  fprintf(stderr, "  -f script  run the commands in a script file as a batch\n");
+  fprintf(stderr, "  -e         stop a batch at the first command that fails\n");
+  fprintf(stderr, "  -t         run the whole batch as one transaction\n");
+  fprintf(stderr, "  -s         mount DISK shared with other command_line -s processes\n");
+  fprintf(stderr, "  -y mode    when writes are synced: none (the default), op (after every\n");
+  fprintf(stderr, "             command that changes DISK) or every ms milliseconds\n");
+  fprintf(stderr, "  -T trace   record every file system call in trace (for jfs_replay)\n");
+  exit(2);
+}
+
+
+
+int main(int argc, char* argv[]) {
   char input_buffer[MAX_CMD_LENGTH];
+  int batch = 0, stop_on_error = 0, transaction = 0, shared = 0;
+  int sync_mode = JFS_SYNC_NONE, sync_ms = 0;
+  FILE* script = stdin;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bf:etsy:T:")) != -1) {
+    switch (opt) {
+    case 'b':
+      batch = 1;
+      break;
+    case 'f':
+      batch = 1;
+      if (0 != strcmp(optarg, "-") && NULL == (script = fopen(optarg, "r"))) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'e':
+      stop_on_error = 1;
+      break;
+    case 't':
+      transaction = 1;
+      break;
+    case 's':
+      shared = 1;
+      break;
+    case 'y':
+      if (0 == strcmp(optarg, "op")) {
+        sync_mode = JFS_SYNC_OP;
+      } else if (0 != strcmp(optarg, "none")) {
+        sync_mode = JFS_SYNC_PERIODIC;
+        sync_ms = atoi(optarg);
+        if (sync_ms <= 0) {
+          usage();
+        }
+      }
+      break;
+    case 'T':
+      if (trace_open(optarg) < 0) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || (!batch && (stop_on_error || transaction))) {
+    usage();
+  }
 
   /*
   printf("File system parameters:\n");
@@ -245,7 +478,24 @@ int main() {
   printf("sizeof block struct = %ld\n\n", sizeof(struct block));
   */
 
-  jfs_mount(DISK_FILENAME);
+  if ((shared ? jfs_mount_shared(DISK_FILENAME) : jfs_mount(DISK_FILENAME)) < 0) {
+    perror("ERROR: cannot mount " DISK_FILENAME " (is another process using it?)");
+    return 1;
+  }
+  if (jfs_durability(sync_mode, sync_ms) != E_SUCCESS) {
+    fprintf(stderr, "ERROR: cannot set up syncing of " DISK_FILENAME "\n");
+    jfs_unmount();
+    return 1;
+  }
+
+  if (batch) {
+    int status = run_batch(script, stop_on_error, transaction);
+    jfs_unmount();
+    if (trace_close() < 0) {
+      fprintf(stderr, "ERROR: the trace could not be written completely\n");
+    }
+    return status;
+  }
 
   prompt_for_input(input_buffer, MAX_CMD_LENGTH);
   while (0 != strcmp(input_buffer, "exit\n")) {
@@ -253,5 +503,8 @@ int main() {
     prompt_for_input(input_buffer, MAX_CMD_LENGTH);
   }
   jfs_unmount();
+  if (trace_close() < 0) {
+    fprintf(stderr, "ERROR: the trace could not be written completely\n");
+  }
   return 0;
 }
@@ -0,0 +1,172 @@
+#include "compress.h"
+#include <stdint.h>
+#include <string.h>
+
+// shortest match worth encoding (a match costs at least 3 bytes)
+#define MIN_MATCH 4
+
+// the match finder remembers the last position of each hashed 4-byte prefix
+#define HASH_BITS 10
+
+
+static uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+static int hash32(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+// writes an extended length (the part that didn't fit in the token nibble)
+static int put_length(unsigned char* dst, int pos, int cap, int len) {
+  while (len >= 255) {
+    if (pos >= cap) {
+      return -1;
+    }
+    dst[pos++] = 255;
+    len -= 255;
+  }
+  if (pos >= cap) {
+    return -1;
+  }
+  dst[pos++] = len;
+  return pos;
+}
+
+
+// reads an extended length; returns the new position or -1 if truncated
+static int get_length(const unsigned char* src, int pos, int len, int* value) {
+  unsigned char byte;
+  do {
+    if (pos >= len) {
+      return -1;
+    }
+    byte = src[pos++];
+    *value += byte;
+  } while (byte == 255);
+  return pos;
+}
+
+
+// emits one sequence: literals followed by an optional match (mlen == 0 means none)
+static int put_sequence(unsigned char* dst, int pos, int cap,
+                        const unsigned char* lit, int llen, int offset, int mlen) {
+  if (pos >= cap) {
+    return -1;
+  }
+  int token = pos++;
+  dst[token] = (llen < 15 ? llen : 15) << 4;
+  if (llen >= 15 && (pos = put_length(dst, pos, cap, llen - 15)) < 0) {
+    return -1;
+  }
+  if (pos + llen > cap) {
+    return -1;
+  }
+  memcpy(dst + pos, lit, llen);
+  pos += llen;
+  if (mlen == 0) {
+    return pos;
+  }
+
+  if (pos + 2 > cap) {
+    return -1;
+  }
+  dst[pos++] = offset & 0xff;
+  dst[pos++] = offset >> 8;
+  mlen -= MIN_MATCH;
+  dst[token] |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15 && (pos = put_length(dst, pos, cap, mlen - 15)) < 0) {
+    return -1;
+  }
+  return pos;
+}
+
+
+int lz_compress(const void* src, int len, void* dst, int cap) {
+  const unsigned char* in = (const unsigned char*) src;
+  unsigned char* out = (unsigned char*) dst;
+  int table[1 << HASH_BITS];
+  for (int i = 0; i < (1 << HASH_BITS); i++) {
+    table[i] = -1;
+  }
+
+  int pos = 0;
+  int anchor = 0;
+  int ip = 0;
+  while (ip + MIN_MATCH <= len) {
+    int h = hash32(read32(in + ip));
+    int ref = table[h];
+    table[h] = ip;
+    if (ref < 0 || ip - ref > 0xffff || read32(in + ref) != read32(in + ip)) {
+      ip++;
+      continue;
+    }
+
+    // extend the match as far as it goes
+    int mlen = MIN_MATCH;
+    while (ip + mlen < len && in[ref + mlen] == in[ip + mlen]) {
+      mlen++;
+    }
+    pos = put_sequence(out, pos, cap, in + anchor, ip - anchor, ip - ref, mlen);
+    if (pos < 0) {
+      return -1;
+    }
+    ip += mlen;
+    anchor = ip;
+  }
+
+  // whatever is left over is stored as literals
+  if (anchor < len) {
+    pos = put_sequence(out, pos, cap, in + anchor, len - anchor, 0, 0);
+  }
+  return pos;
+}
+
+
+int lz_decompress(const void* src, int len, void* dst, int cap) {
+  const unsigned char* in = (const unsigned char*) src;
+  unsigned char* out = (unsigned char*) dst;
+  int ip = 0;
+  int op = 0;
+  while (ip < len) {
+    unsigned char token = in[ip++];
+
+    // copy the literals
+    int llen = token >> 4;
+    if (llen == 15 && (ip = get_length(in, ip, len, &llen)) < 0) {
+      return -1;
+    }
+    if (ip + llen > len || op + llen > cap) {
+      return -1;
+    }
+    memcpy(out + op, in + ip, llen);
+    ip += llen;
+    op += llen;
+    if (ip == len) {
+      break; // the last sequence has no match
+    }
+
+    // copy the match (byte by byte, because it may overlap itself)
+    if (ip + 2 > len) {
+      return -1;
+    }
+    int offset = in[ip] | (in[ip + 1] << 8);
+    ip += 2;
+    int mlen = token & 15;
+    if (mlen == 15 && (ip = get_length(in, ip, len, &mlen)) < 0) {
+      return -1;
+    }
+    mlen += MIN_MATCH;
+    if (offset == 0 || offset > op || op + mlen > cap) {
+      return -1;
+    }
+    for (int i = 0; i < mlen; i++, op++) {
+      out[op] = out[op - offset];
+    }
+  }
+  return op;
+}
@@ -0,0 +1,36 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include "raw_disk.h"
+
+// number of consecutive data blocks that are compressed together as a group
+#define COMPRESS_GROUP_BLOCKS 4
+
+// number of (uncompressed) bytes in a full group
+#define COMPRESS_GROUP_SIZE (COMPRESS_GROUP_BLOCKS * BLOCK_SIZE)
+
+
+/* lz_compress
+ *   compresses a buffer with a small LZ77 codec (the sequence format is the
+ *   same as an LZ4 block: token, literals, 2-byte offset, match length)
+ * src - data to compress
+ * len - number of bytes in src
+ * dst - buffer the compressed data will be written to
+ * cap - size of dst in bytes
+ * returns the number of bytes written to dst, or -1 if the compressed data
+ *   does not fit in cap bytes
+ */
+int lz_compress(const void* src, int len, void* dst, int cap);
+
+/* lz_decompress
+ *   decompresses data produced by lz_compress()
+ * src - compressed data
+ * len - number of bytes in src
+ * dst - buffer the decompressed data will be written to
+ * cap - size of dst in bytes
+ * returns the number of bytes written to dst, or -1 if the compressed data is
+ *   malformed or would not fit in cap bytes
+ */
+int lz_decompress(const void* src, int len, void* dst, int cap);
+
+#endif // _COMPRESS_H_
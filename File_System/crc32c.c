@@ -0,0 +1,99 @@
+#include "crc32c.h"
+#include <string.h>
+
+// the reflected Castagnoli polynomial
+#define POLY 0x82f63b78
+
+// table[k][b] is the CRC of byte b followed by k zero bytes (slicing by 8)
+static uint32_t table[8][256];
+static int table_ready = 0;
+
+
+static void make_table() {
+  for (int b = 0; b < 256; b++) {
+    uint32_t crc = b;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (POLY & -(crc & 1));
+    }
+    table[0][b] = crc;
+  }
+  for (int b = 0; b < 256; b++) {
+    for (int k = 1; k < 8; k++) {
+      table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+    }
+  }
+  table_ready = 1;
+}
+
+
+uint32_t crc32c_sw(uint32_t crc, const void* buf, size_t len) {
+  if (!table_ready) {
+    make_table();
+  }
+  const unsigned char* p = buf;
+  crc = ~crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    word ^= crc;
+    crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff]
+        ^ table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff]
+        ^ table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff]
+        ^ table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+  }
+  return ~crc;
+}
+
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len) {
+  const unsigned char* p = buf;
+  uint64_t crc64 = ~crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  uint32_t crc32 = crc64;
+  while (len-- > 0) {
+    crc32 = __builtin_ia32_crc32qi(crc32, *p++);
+  }
+  return ~crc32;
+}
+
+
+int crc32c_hw_available() {
+  static int available = -1;
+  if (available < 0) {
+    __builtin_cpu_init();
+    available = __builtin_cpu_supports("sse4.2") != 0;
+  }
+  return available;
+}
+
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+  return crc32c_hw_available() ? crc32c_hw(crc, buf, len) : crc32c_sw(crc, buf, len);
+}
+
+#else
+
+int crc32c_hw_available() {
+  return 0;
+}
+
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+  return crc32c_sw(crc, buf, len);
+}
+
+#endif
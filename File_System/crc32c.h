@@ -0,0 +1,25 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* crc32c
+ *   computes the CRC-32C (Castagnoli) of a buffer, with the SSE4.2 crc32
+ *   instruction when the CPU has it and a lookup table otherwise
+ * crc - 0 to start, or the result for the data that comes before buf
+ * returns the CRC of everything so far
+ */
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
+/* crc32c_sw
+ *   the same as crc32c, always with the lookup table
+ */
+uint32_t crc32c_sw(uint32_t crc, const void* buf, size_t len);
+
+/* crc32c_hw_available
+ *   returns 1 if crc32c uses the crc32 instruction, 0 otherwise
+ */
+int crc32c_hw_available();
+
+#endif // _CRC32C_H_
@@ -0,0 +1,115 @@
+#include "dedup.h"
+#include <string.h>
+#include <time.h>
+
+// open addressing table with room for every block on the disk (load factor <= 1/2)
+#define INDEX_SIZE (2 * NUM_BLOCKS)
+
+// slot states besides the number of an indexed block
+#define SLOT_EMPTY 0
+#define SLOT_DELETED ((block_num_t) -1)
+
+static struct {
+  uint64_t fingerprint;
+  block_num_t block;
+} index_slots[INDEX_SIZE];
+
+// slot of each indexed block, so blocks can be forgotten without rehashing them
+static int slot_of[NUM_BLOCKS];
+
+static struct dedup_stats stats;
+
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// 64-bit FNV-1a over the block, 8 bytes at a time
+static uint64_t fingerprint(const void* data) {
+  const unsigned char* p = (const unsigned char*) data;
+  uint64_t h = 14695981039346656037ull;
+  for (int i = 0; i < BLOCK_SIZE; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    h = (h ^ word) * 1099511628211ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+
+void dedup_reset() {
+  memset(index_slots, 0, sizeof(index_slots));
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    slot_of[i] = -1;
+  }
+  memset(&stats, 0, sizeof(stats));
+}
+
+
+void dedup_insert(block_num_t block, const void* data) {
+  if (slot_of[block] >= 0) {
+    return;
+  }
+  uint64_t fp = fingerprint(data);
+  int slot = fp % INDEX_SIZE;
+  while (index_slots[slot].block != SLOT_EMPTY && index_slots[slot].block != SLOT_DELETED) {
+    slot = (slot + 1) % INDEX_SIZE;
+  }
+  index_slots[slot].fingerprint = fp;
+  index_slots[slot].block = block;
+  slot_of[block] = slot;
+  stats.indexed += 1;
+}
+
+
+block_num_t dedup_lookup(const void* data) {
+  uint64_t start = now_ns();
+  uint64_t fp = fingerprint(data);
+  block_num_t found = 0;
+  stats.lookups += 1;
+  for (int slot = fp % INDEX_SIZE, n = 0;
+       index_slots[slot].block != SLOT_EMPTY && n < INDEX_SIZE;
+       slot = (slot + 1) % INDEX_SIZE, n++) {
+    stats.probes += 1;
+    if (index_slots[slot].block == SLOT_DELETED || index_slots[slot].fingerprint != fp) {
+      continue;
+    }
+    // a matching fingerprint is only a hint; compare the actual bytes
+    char candidate[BLOCK_SIZE];
+    stats.verify_reads += 1;
+    if (read_block(index_slots[slot].block, candidate) == 0
+        && memcmp(candidate, data, BLOCK_SIZE) == 0
+        && ref_block(index_slots[slot].block) == 0) {
+      found = index_slots[slot].block;
+      stats.hits += 1;
+      break;
+    }
+  }
+  stats.lookup_ns += now_ns() - start;
+  return found;
+}
+
+
+void dedup_forget(block_num_t block) {
+  if (slot_of[block] < 0) {
+    return;
+  }
+  index_slots[slot_of[block]].block = SLOT_DELETED;
+  slot_of[block] = -1;
+  stats.indexed -= 1;
+}
+
+
+void dedup_get_stats(struct dedup_stats* buf) {
+  *buf = stats;
+  buf->references = 0;
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    if (slot_of[i] >= 0) {
+      buf->references += block_refs(i);
+    }
+  }
+}
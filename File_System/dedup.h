@@ -0,0 +1,49 @@
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "basic_file_system.h"
+
+// Struct returned by jfs_dedup_stats()
+struct dedup_stats {
+  uint32_t lookups;      // full data blocks looked up in the fingerprint index
+  uint32_t hits;         // lookups that found an identical block to share
+  uint32_t probes;       // index slots examined by all the lookups
+  uint32_t verify_reads; // candidate blocks read back to compare their bytes
+  uint64_t lookup_ns;    // time spent in lookups (hashing, probing and verifying)
+  uint32_t indexed;      // distinct data blocks currently in the index
+  uint32_t references;   // references from files to the indexed blocks
+};
+
+
+/* dedup_reset
+ *   empties the fingerprint index and zeroes the lookup counters
+ */
+void dedup_reset();
+
+/* dedup_insert
+ *   adds a full data block to the fingerprint index
+ * block - number of the block
+ * data - the BLOCK_SIZE bytes stored in the block
+ */
+void dedup_insert(block_num_t block, const void* data);
+
+/* dedup_lookup
+ *   looks for an allocated block with exactly the given contents, and takes a
+ *   new reference to it (with ref_block) if there is one
+ * data - BLOCK_SIZE bytes to look for
+ * returns the number of the shared block, or 0 if there is no identical block
+ *   (or it cannot take any more references)
+ */
+block_num_t dedup_lookup(const void* data);
+
+/* dedup_forget
+ *   removes a block from the index (called before its last reference is released)
+ */
+void dedup_forget(block_num_t block);
+
+/* dedup_get_stats
+ *   fills in the lookup counters and the current size of the index
+ */
+void dedup_get_stats(struct dedup_stats* stats);
+
+#endif // _DEDUP_H_
@@ -0,0 +1,804 @@
+#define _GNU_SOURCE // for O_DIRECT
+#include "disk_backend.h"
+#include "raw_disk.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+
+/* file backend: the image is a regular file */
+
+static int file_mount(struct disk_dev* dev, const char* path) {
+  // open file; creat if it doesn't exist already
+  dev->fd = open(path, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+  if (dev->fd < 0) {
+    return -1;
+  }
+
+  // if the file size is less than it should be, we need to extend it with 0's
+  struct stat st;
+  if (fstat(dev->fd, &st) < 0) {
+    goto fail;
+  }
+  if ((size_t) st.st_size < dev->size) {
+    size_t to_write = dev->size - st.st_size;
+    char* buffer = calloc(to_write, 1);
+    int ret = pwrite(dev->fd, buffer, to_write, st.st_size);
+    free(buffer);
+    if (ret < (int) to_write) {
+      goto fail;
+    }
+  }
+  return 0;
+
+fail:
+  close(dev->fd);
+  dev->fd = -1;
+  return -1;
+}
+
+
+static int file_read(struct disk_dev* dev, void* buf, size_t len, off_t offset) {
+  return pread(dev->fd, buf, len, offset) == (ssize_t) len ? 0 : -1;
+}
+
+
+static int file_write(struct disk_dev* dev, const void* buf, size_t len, off_t offset) {
+  return pwrite(dev->fd, buf, len, offset) == (ssize_t) len ? 0 : -1;
+}
+
+
+static int file_flush(struct disk_dev* dev) {
+  return fdatasync(dev->fd);
+}
+
+
+static int file_unmount(struct disk_dev* dev) {
+  int ret = close(dev->fd);
+  dev->fd = -1;
+  return ret;
+}
+
+
+static int file_remove(const char* path) {
+  return unlink(path);
+}
+
+
+static int file_uncache(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  // only clean pages are dropped, so write the dirty ones out first
+  int ret = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 ? 0 : -1;
+  close(fd);
+  return ret;
+}
+
+
+static int file_exists(const char* path) {
+  return access(path, F_OK);
+}
+
+
+static const struct disk_backend file_backend = {
+  "", file_mount, file_read, file_write, file_flush, file_unmount, NULL, file_remove, file_uncache,
+  file_exists
+};
+
+
+/* ram backend: the image only exists in memory */
+
+static int ram_mount(struct disk_dev* dev, const char* path) {
+  (void) path;
+  dev->priv = calloc(dev->size, 1);
+  return dev->priv != NULL ? 0 : -1;
+}
+
+
+static int ram_read(struct disk_dev* dev, void* buf, size_t len, off_t offset) {
+  memcpy(buf, (char*) dev->priv + offset, len);
+  return 0;
+}
+
+
+static int ram_write(struct disk_dev* dev, const void* buf, size_t len, off_t offset) {
+  memcpy((char*) dev->priv + offset, buf, len);
+  return 0;
+}
+
+
+static int ram_flush(struct disk_dev* dev) {
+  (void) dev;
+  return 0;
+}
+
+
+static int ram_unmount(struct disk_dev* dev) {
+  free(dev->priv);
+  dev->priv = NULL;
+  return 0;
+}
+
+
+static int ram_remove(const char* path) {
+  (void) path;
+  return 0;
+}
+
+
+// nothing of a ram: image is left before it is mounted
+static int ram_exists(const char* path) {
+  (void) path;
+  errno = ENOENT;
+  return -1;
+}
+
+
+static const struct disk_backend ram_backend = {
+  "ram:", ram_mount, ram_read, ram_write, ram_flush, ram_unmount, NULL, ram_remove, ram_remove,
+  ram_exists
+};
+
+
+/* hdd and ssd backends: the file backend, plus a delay for every request.
+ * A request that doesn't start where the previous one ended pays for a seek
+ * (growing with the distance, from min_seek_us to seek_us over the whole
+ * image) and the average rotational delay; every request pays request_us
+ * (and writes write_us on top), and the transfer at xfer_mbps.
+ */
+
+struct latency_model {
+  uint32_t request_us;
+  uint32_t write_us;
+  uint32_t min_seek_us;
+  uint32_t seek_us;
+  uint32_t rotate_us;
+  uint32_t xfer_mbps;
+};
+
+struct latency_state {
+  struct latency_model model;
+  off_t head;   // where the previous request ended
+};
+
+// a 7200 rpm disk, and a SATA flash drive
+static const struct latency_model hdd_model = {50, 0, 500, 8000, 4170, 150};
+static const struct latency_model ssd_model = {60, 20, 0, 0, 0, 500};
+
+
+// applies "name=value,..." settings from JFS_LATENCY to a model
+static void parse_model(struct latency_model* model) {
+  static const struct {
+    const char* name;
+    size_t offset;
+  } params[] = {
+    {"request_us", offsetof(struct latency_model, request_us)},
+    {"write_us", offsetof(struct latency_model, write_us)},
+    {"min_seek_us", offsetof(struct latency_model, min_seek_us)},
+    {"seek_us", offsetof(struct latency_model, seek_us)},
+    {"rotate_us", offsetof(struct latency_model, rotate_us)},
+    {"xfer_mbps", offsetof(struct latency_model, xfer_mbps)},
+  };
+  const char* env = getenv("JFS_LATENCY");
+  while (env != NULL && *env != '\0') {
+    size_t len = strcspn(env, "=");
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+      if (strlen(params[i].name) == len && 0 == strncmp(env, params[i].name, len) && env[len] == '=') {
+        *(uint32_t*) ((char*) model + params[i].offset) = strtoul(env + len + 1, NULL, 10);
+      }
+    }
+    env = strchr(env, ',');
+    env = env != NULL ? env + 1 : NULL;
+  }
+}
+
+
+static int latency_mount(struct disk_dev* dev, const char* path, const struct latency_model* model) {
+  struct latency_state* state = malloc(sizeof(struct latency_state));
+  if (state == NULL) {
+    return -1;
+  }
+  state->model = *model;
+  state->head = 0;
+  parse_model(&state->model);
+  if (file_mount(dev, path) < 0) {
+    free(state);
+    return -1;
+  }
+  dev->priv = state;
+  return 0;
+}
+
+
+static int hdd_mount(struct disk_dev* dev, const char* path) {
+  return latency_mount(dev, path, &hdd_model);
+}
+
+
+static int ssd_mount(struct disk_dev* dev, const char* path) {
+  return latency_mount(dev, path, &ssd_model);
+}
+
+
+// waits out the modelled time of one request
+static void delay(struct disk_dev* dev, size_t len, off_t offset, int is_write) {
+  struct latency_state* state = dev->priv;
+  struct latency_model* m = &state->model;
+  uint64_t ns = (uint64_t) m->request_us * 1000;
+  if (is_write) {
+    ns += (uint64_t) m->write_us * 1000;
+  }
+  if (offset != state->head) {
+    uint64_t distance = offset > state->head ? offset - state->head : state->head - offset;
+    ns += (uint64_t) m->min_seek_us * 1000;
+    if (m->seek_us > m->min_seek_us) {
+      ns += (uint64_t) (m->seek_us - m->min_seek_us) * 1000 * distance / dev->size;
+    }
+    ns += (uint64_t) m->rotate_us * 1000;
+  }
+  if (m->xfer_mbps > 0) {
+    ns += (uint64_t) len * 1000 / m->xfer_mbps;
+  }
+  state->head = offset + len;
+
+  // sleep for most of it, and spin for the rest so short delays come out right
+  struct timespec now, end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  uint64_t deadline = (uint64_t) end.tv_sec * 1000000000 + end.tv_nsec + ns;
+  if (ns > 200000) {
+    uint64_t wake = deadline - 100000;
+    end.tv_sec = wake / 1000000000;
+    end.tv_nsec = wake % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL) != 0) {}
+  }
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec < deadline);
+}
+
+
+static int latency_read(struct disk_dev* dev, void* buf, size_t len, off_t offset) {
+  delay(dev, len, offset, 0);
+  return file_read(dev, buf, len, offset);
+}
+
+
+static int latency_write(struct disk_dev* dev, const void* buf, size_t len, off_t offset) {
+  delay(dev, len, offset, 1);
+  return file_write(dev, buf, len, offset);
+}
+
+
+static int latency_unmount(struct disk_dev* dev) {
+  free(dev->priv);
+  dev->priv = NULL;
+  return file_unmount(dev);
+}
+
+
+static const struct disk_backend hdd_backend = {
+  "hdd:", hdd_mount, latency_read, latency_write, file_flush, latency_unmount, NULL, file_remove,
+  file_uncache, file_exists
+};
+
+static const struct disk_backend ssd_backend = {
+  "ssd:", ssd_mount, latency_read, latency_write, file_flush, latency_unmount, NULL, file_remove,
+  file_uncache, file_exists
+};
+
+
+/* direct backend: the image file opened with O_DIRECT, so the page cache of
+ * the host is bypassed.  Every transfer is a whole DIRECT_PAGE_SIZE page
+ * to or from a page-aligned buffer of a fixed pool, which also serves as a
+ * cache of the pages used last (written through, so a page can be dropped
+ * from the pool at any time).
+ */
+
+#define DIRECT_PAGE_SIZE 4096
+#define DIRECT_POOL_PAGES 4
+
+struct direct_page {
+  char* data;
+  off_t offset;             // of the page in the image, -1 if the buffer is unused
+  unsigned long last_used;
+};
+
+struct direct_state {
+  char* pool;               // DIRECT_POOL_PAGES aligned pages
+  struct direct_page pages[DIRECT_POOL_PAGES];
+  unsigned long clock;
+};
+
+
+static int direct_mount(struct disk_dev* dev, const char* path) {
+  if (dev->size % DIRECT_PAGE_SIZE != 0) {
+    return -1;
+  }
+  struct direct_state* state = calloc(1, sizeof(struct direct_state));
+  if (state == NULL) {
+    return -1;
+  }
+  if (posix_memalign((void**) &state->pool, DIRECT_PAGE_SIZE, DIRECT_POOL_PAGES * DIRECT_PAGE_SIZE) != 0) {
+    free(state);
+    return -1;
+  }
+  for (int i = 0; i < DIRECT_POOL_PAGES; i++) {
+    state->pages[i].data = state->pool + i * DIRECT_PAGE_SIZE;
+    state->pages[i].offset = -1;
+  }
+
+  // the image is created (or extended) the usual way, and only then switched to O_DIRECT
+  if (file_mount(dev, path) < 0) {
+    free(state->pool);
+    free(state);
+    return -1;
+  }
+  if (fcntl(dev->fd, F_SETFL, fcntl(dev->fd, F_GETFL) | O_DIRECT) < 0) {
+    file_unmount(dev);
+    free(state->pool);
+    free(state);
+    return -1;
+  }
+  dev->priv = state;
+  return 0;
+}
+
+
+// returns the pool page holding the image page at offset, reading it in if
+// fill is set (otherwise the caller is about to overwrite all of it)
+static struct direct_page* direct_page(struct disk_dev* dev, off_t offset, int fill) {
+  struct direct_state* state = dev->priv;
+  struct direct_page* victim = &state->pages[0];
+  for (int i = 0; i < DIRECT_POOL_PAGES; i++) {
+    struct direct_page* page = &state->pages[i];
+    if (page->offset == offset) {
+      page->last_used = ++state->clock;
+      return page;
+    }
+    if (page->last_used < victim->last_used) {
+      victim = page;
+    }
+  }
+  victim->offset = -1;
+  if (fill && pread(dev->fd, victim->data, DIRECT_PAGE_SIZE, offset) != DIRECT_PAGE_SIZE) {
+    return NULL;
+  }
+  victim->offset = offset;
+  victim->last_used = ++state->clock;
+  return victim;
+}
+
+
+static int direct_read(struct disk_dev* dev, void* buf, size_t len, off_t offset) {
+  while (len > 0) {
+    off_t page_offset = offset - offset % DIRECT_PAGE_SIZE;
+    size_t in_page = offset - page_offset;
+    size_t n = DIRECT_PAGE_SIZE - in_page < len ? DIRECT_PAGE_SIZE - in_page : len;
+    struct direct_page* page = direct_page(dev, page_offset, 1);
+    if (page == NULL) {
+      return -1;
+    }
+    memcpy(buf, page->data + in_page, n);
+    buf = (char*) buf + n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+static int direct_write(struct disk_dev* dev, const void* buf, size_t len, off_t offset) {
+  while (len > 0) {
+    off_t page_offset = offset - offset % DIRECT_PAGE_SIZE;
+    size_t in_page = offset - page_offset;
+    size_t n = DIRECT_PAGE_SIZE - in_page < len ? DIRECT_PAGE_SIZE - in_page : len;
+    struct direct_page* page = direct_page(dev, page_offset, n < DIRECT_PAGE_SIZE);
+    if (page == NULL) {
+      return -1;
+    }
+    memcpy(page->data + in_page, buf, n);
+    if (pwrite(dev->fd, page->data, DIRECT_PAGE_SIZE, page_offset) != DIRECT_PAGE_SIZE) {
+      page->offset = -1;  // no longer known to match the image
+      return -1;
+    }
+    buf = (const char*) buf + n;
+    offset += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+static int direct_unmount(struct disk_dev* dev) {
+  struct direct_state* state = dev->priv;
+  free(state->pool);
+  free(state);
+  dev->priv = NULL;
+  return file_unmount(dev);
+}
+
+
+static const struct disk_backend direct_backend = {
+  "direct:", direct_mount, direct_read, direct_write, file_flush, direct_unmount, NULL, file_remove,
+  file_uncache, file_exists
+};
+
+
+/* stripe backend: the image is split into units that go round-robin to a
+ * set of member files.  Every member has a worker thread; a batch is cut up
+ * into the pieces for each member, and all the workers run their pieces at
+ * the same time.
+ */
+
+#define MAX_STRIPE_MEMBERS 16
+
+struct stripe_piece {
+  char* buf;
+  size_t len;
+  off_t offset;   // in the member file
+};
+
+struct stripe_member {
+  struct disk_dev file;
+  pthread_t thread;
+  struct stripe_piece* pieces;  // the member's part of the current batch
+  int num_pieces;
+  int max_pieces;
+  int ret;
+};
+
+struct stripe_state {
+  size_t unit;
+  int num_members;
+  struct stripe_member members[MAX_STRIPE_MEMBERS];
+  pthread_mutex_t lock;
+  pthread_cond_t start;     // a new batch is ready
+  pthread_cond_t finished;  // a worker has done its part
+  unsigned long batch;      // number of the current batch
+  int busy;                 // workers still running the current batch
+  int op;                   // of the current batch
+  int stopping;
+};
+
+enum {STRIPE_READ, STRIPE_WRITE, STRIPE_FLUSH};
+
+
+static int run_pieces(struct stripe_member* member, int op) {
+  if (op == STRIPE_FLUSH) {
+    return file_flush(&member->file);
+  }
+  for (int i = 0; i < member->num_pieces; i++) {
+    struct stripe_piece* p = &member->pieces[i];
+    int ret = op == STRIPE_READ ? file_read(&member->file, p->buf, p->len, p->offset)
+                                : file_write(&member->file, p->buf, p->len, p->offset);
+    if (ret < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+struct worker_arg {
+  struct stripe_state* state;
+  int index;
+};
+
+
+static void* stripe_worker(void* p) {
+  struct worker_arg arg = *(struct worker_arg*) p;
+  free(p);
+  struct stripe_state* state = arg.state;
+  struct stripe_member* member = &state->members[arg.index];
+  unsigned long done = 0;
+
+  pthread_mutex_lock(&state->lock);
+  for (;;) {
+    while (state->batch == done && !state->stopping) {
+      pthread_cond_wait(&state->start, &state->lock);
+    }
+    if (state->stopping) {
+      break;
+    }
+    done = state->batch;
+    int op = state->op;
+    pthread_mutex_unlock(&state->lock);
+    int ret = run_pieces(member, op);
+    pthread_mutex_lock(&state->lock);
+    member->ret = ret;
+    if (--state->busy == 0) {
+      pthread_cond_signal(&state->finished);
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  return NULL;
+}
+
+
+// hands the pieces that were queued to the workers and waits for them all
+static int run_batch(struct stripe_state* state, int op) {
+  // a batch that only touches one member is quicker done here
+  int active = -1;
+  for (int i = 0; i < state->num_members && op != STRIPE_FLUSH; i++) {
+    if (state->members[i].num_pieces > 0) {
+      active = (active == -1) ? i : -2;
+    }
+  }
+  if (active >= 0) {
+    int ret = run_pieces(&state->members[active], op);
+    state->members[active].num_pieces = 0;
+    return ret;
+  } else if (active == -1 && op != STRIPE_FLUSH) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&state->lock);
+  state->op = op;
+  state->busy = state->num_members;
+  state->batch++;
+  pthread_cond_broadcast(&state->start);
+  while (state->busy > 0) {
+    pthread_cond_wait(&state->finished, &state->lock);
+  }
+  pthread_mutex_unlock(&state->lock);
+
+  int ret = 0;
+  for (int i = 0; i < state->num_members; i++) {
+    ret |= state->members[i].ret;
+    state->members[i].num_pieces = 0;
+  }
+  return ret;
+}
+
+
+// queues the pieces of one request for the members they belong to
+static void split_request(struct stripe_state* state, char* buf, size_t len, off_t offset) {
+  while (len > 0) {
+    size_t unit_num = offset / state->unit;
+    size_t in_unit = offset % state->unit;
+    size_t n = state->unit - in_unit < len ? state->unit - in_unit : len;
+    struct stripe_member* member = &state->members[unit_num % state->num_members];
+
+    off_t member_offset = (unit_num / state->num_members) * state->unit + in_unit;
+    struct stripe_piece* last = member->num_pieces > 0 ? &member->pieces[member->num_pieces - 1] : NULL;
+    if (last != NULL && last->buf + last->len == buf && last->offset + (off_t) last->len == member_offset) {
+      last->len += n;  // continues the previous piece
+    } else {
+      if (member->num_pieces == member->max_pieces) {
+        member->max_pieces = member->max_pieces ? member->max_pieces * 2 : 16;
+        member->pieces = realloc(member->pieces, member->max_pieces * sizeof(struct stripe_piece));
+      }
+      member->pieces[member->num_pieces++] = (struct stripe_piece) {buf, n, member_offset};
+    }
+    buf += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+
+static int stripe_submit(struct disk_dev* dev, struct disk_io* ios, int count, int is_write) {
+  struct stripe_state* state = dev->priv;
+  for (int i = 0; i < count; i++) {
+    split_request(state, ios[i].buf, ios[i].len, ios[i].offset);
+  }
+  return run_batch(state, is_write ? STRIPE_WRITE : STRIPE_READ);
+}
+
+
+static int stripe_read(struct disk_dev* dev, void* buf, size_t len, off_t offset) {
+  struct disk_io io = {buf, len, offset};
+  return stripe_submit(dev, &io, 1, 0);
+}
+
+
+static int stripe_write(struct disk_dev* dev, const void* buf, size_t len, off_t offset) {
+  struct disk_io io = {(void*) buf, len, offset};
+  return stripe_submit(dev, &io, 1, 1);
+}
+
+
+static int stripe_flush(struct disk_dev* dev) {
+  return run_batch(dev->priv, STRIPE_FLUSH);
+}
+
+
+static void stop_workers(struct stripe_state* state, int started) {
+  pthread_mutex_lock(&state->lock);
+  state->stopping = 1;
+  pthread_cond_broadcast(&state->start);
+  pthread_mutex_unlock(&state->lock);
+  for (int i = 0; i < started; i++) {
+    pthread_join(state->members[i].thread, NULL);
+  }
+}
+
+
+static int stripe_unmount(struct disk_dev* dev) {
+  struct stripe_state* state = dev->priv;
+  int ret = 0;
+  stop_workers(state, state->num_members);
+  for (int i = 0; i < state->num_members; i++) {
+    ret |= file_unmount(&state->members[i].file);
+    free(state->members[i].pieces);
+  }
+  pthread_mutex_destroy(&state->lock);
+  pthread_cond_destroy(&state->start);
+  pthread_cond_destroy(&state->finished);
+  free(state);
+  dev->priv = NULL;
+  dev->fd = -1;
+  return ret;
+}
+
+
+// path is "unit:file,file,..."
+static int stripe_mount(struct disk_dev* dev, const char* path) {
+  char* end;
+  size_t unit = strtoul(path, &end, 10);
+  if (*end != ':' || unit == 0 || unit % BLOCK_SIZE != 0) {
+    return -1;
+  }
+  struct stripe_state* state = calloc(1, sizeof(struct stripe_state));
+  if (state == NULL) {
+    return -1;
+  }
+  state->unit = unit;
+  pthread_mutex_init(&state->lock, NULL);
+  pthread_cond_init(&state->start, NULL);
+  pthread_cond_init(&state->finished, NULL);
+
+  // count the members first, so each knows its size
+  int n = 1;
+  for (const char* c = end + 1; *c != '\0'; c++) {
+    n += *c == ',';
+  }
+  size_t units = (dev->size + unit - 1) / unit;
+  size_t member_size = ((units + n - 1) / n) * unit;
+
+  int started = 0;
+  char* names = strdup(end + 1);
+  char* save = NULL;
+  for (char* name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+    if (state->num_members == MAX_STRIPE_MEMBERS) {
+      goto fail;
+    }
+    struct stripe_member* member = &state->members[state->num_members];
+    member->file.size = member_size;
+    if (file_mount(&member->file, name) < 0) {
+      goto fail;
+    }
+    state->num_members++;
+  }
+  if (state->num_members == 0) {
+    goto fail;
+  }
+  for (; started < state->num_members; started++) {
+    struct worker_arg* arg = malloc(sizeof(struct worker_arg));
+    *arg = (struct worker_arg) {state, started};
+    if (pthread_create(&state->members[started].thread, NULL, stripe_worker, arg) != 0) {
+      free(arg);
+      goto fail;
+    }
+  }
+  free(names);
+
+  // the image is locked through its first member
+  dev->fd = state->members[0].file.fd;
+  dev->priv = state;
+  return 0;
+
+fail:
+  free(names);
+  stop_workers(state, started);
+  for (int i = 0; i < state->num_members; i++) {
+    file_unmount(&state->members[i].file);
+  }
+  free(state);
+  return -1;
+}
+
+
+// runs fn on every file of a striped image (all of them, even after one fails)
+static int stripe_each(const char* path, int (*fn)(const char* name)) {
+  const char* names = strchr(path, ':');
+  if (names == NULL) {
+    return -1;
+  }
+  int ret = 0;
+  char* copy = strdup(names + 1);
+  char* save = NULL;
+  for (char* name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+    ret |= fn(name);
+  }
+  free(copy);
+  return ret;
+}
+
+
+static int stripe_remove(const char* path) {
+  return stripe_each(path, file_remove);
+}
+
+
+static int stripe_uncache(const char* path) {
+  return stripe_each(path, file_uncache);
+}
+
+
+static int stripe_exists(const char* path) {
+  return stripe_each(path, file_exists);
+}
+
+
+static const struct disk_backend stripe_backend = {
+  "stripe:", stripe_mount, stripe_read, stripe_write, stripe_flush, stripe_unmount, stripe_submit,
+  stripe_remove, stripe_uncache, stripe_exists
+};
+
+
+// the file backend goes last: its empty prefix matches every name
+static const struct disk_backend* const backends[] = {
+  &ram_backend, &hdd_backend, &ssd_backend, &direct_backend, &stripe_backend, &file_backend
+};
+
+
+static const struct disk_backend* find_backend(const char* name) {
+  size_t i = 0;
+  while (0 != strncmp(name, backends[i]->prefix, strlen(backends[i]->prefix))) {
+    i++;
+  }
+  return backends[i];
+}
+
+
+int backend_mount(struct disk_dev* dev, const char* name, size_t size) {
+  dev->ops = find_backend(name);
+  dev->fd = -1;
+  dev->size = size;
+  dev->priv = NULL;
+  return dev->ops->mount(dev, name + strlen(dev->ops->prefix));
+}
+
+
+int backend_remove(const char* name) {
+  const struct disk_backend* ops = find_backend(name);
+  return ops->remove(name + strlen(ops->prefix));
+}
+
+
+int backend_uncache(const char* name) {
+  const struct disk_backend* ops = find_backend(name);
+  return ops->uncache(name + strlen(ops->prefix));
+}
+
+
+int backend_exists(const char* name) {
+  const struct disk_backend* ops = find_backend(name);
+  return ops->exists(name + strlen(ops->prefix));
+}
+
+
+int backend_submit(struct disk_dev* dev, struct disk_io* ios, int count, int is_write) {
+  if (dev->ops->submit != NULL) {
+    return dev->ops->submit(dev, ios, count, is_write);
+  }
+  int ret = 0;
+  for (int i = 0; i < count; i++) {
+    if (is_write) {
+      ret |= dev->ops->write(dev, ios[i].buf, ios[i].len, ios[i].offset);
+    } else {
+      ret |= dev->ops->read(dev, ios[i].buf, ios[i].len, ios[i].offset);
+    }
+  }
+  return ret;
+}
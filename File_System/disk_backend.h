@@ -0,0 +1,94 @@
+#ifndef _DISK_BACKEND_H_
+#define _DISK_BACKEND_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The storage under raw_disk.c.  The name given to raw_mount picks the
+ * backend by its prefix:
+ *   path          the image file (the file backend)
+ *   ram:          a zeroed image in memory that is gone after unmounting
+ *   hdd:path      the image file, with the delays of a hard disk added
+ *   ssd:path      the image file, with the delays of an SSD added
+ *   direct:path   the image file, opened with O_DIRECT: it is read and
+ *                 written in whole 4K pages through a small pool of aligned
+ *                 buffers, bypassing the page cache of the host
+ *   stripe:unit:path,path,...
+ *                 the image striped over several files (RAID 0): the first
+ *                 unit bytes go to the first file, the next unit to the
+ *                 second and so on (unit is a multiple of BLOCK_SIZE); a
+ *                 batch of requests is run on all the files in parallel
+ * The delays of hdd: and ssd: can be changed with the JFS_LATENCY
+ * environment variable, e.g. JFS_LATENCY=seek_us=4000,xfer_mbps=150 (see
+ * struct latency_model in disk_backend.c for all the parameters).
+ */
+
+struct disk_backend;
+
+// one request of a batch
+struct disk_io {
+  void* buf;
+  size_t len;
+  off_t offset;
+};
+
+struct disk_dev {
+  const struct disk_backend* ops;
+  int fd;       // the image file, or -1 if the backend has none (locking and shared mounts need one)
+  size_t size;  // bytes
+  void* priv;   // backend state
+};
+
+// every function returns 0 on success or -1 on failure; reads and writes are all or nothing
+struct disk_backend {
+  const char* prefix;
+  int (*mount)(struct disk_dev* dev, const char* path);
+  int (*read)(struct disk_dev* dev, void* buf, size_t len, off_t offset);
+  int (*write)(struct disk_dev* dev, const void* buf, size_t len, off_t offset);
+  int (*flush)(struct disk_dev* dev);
+  int (*unmount)(struct disk_dev* dev);
+  // runs a batch of reads (is_write 0) or writes (NULL: one after the other with read/write)
+  int (*submit)(struct disk_dev* dev, struct disk_io* ios, int count, int is_write);
+  int (*remove)(const char* path);
+  // drops the host's cached pages of an image that isn't mounted
+  int (*uncache)(const char* path);
+  // checks that the storage of an image is there (without creating it, unlike mount)
+  int (*exists)(const char* path);
+};
+
+/* backend_mount
+ *   picks the backend for name and mounts it into dev, with size bytes of
+ *   storage (a new or short image file is extended with zeros)
+ * returns 0 on success or -1 on failure
+ */
+int backend_mount(struct disk_dev* dev, const char* name, size_t size);
+
+/* backend_remove
+ *   deletes the storage of an image that isn't mounted
+ * returns 0 on success or -1 on failure
+ */
+int backend_remove(const char* name);
+
+/* backend_uncache
+ *   writes out and drops the pages the host caches for an image that isn't
+ *   mounted, so that its next reads come from the device (nothing to do for
+ *   a ram: image)
+ * returns 0 on success or -1 on failure
+ */
+int backend_uncache(const char* name);
+
+/* backend_exists
+ *   checks whether the storage of an image is there (all its files, for a
+ *   striped one; never, for a ram: image)
+ * returns 0 if it is or -1 (with errno set) if it isn't
+ */
+int backend_exists(const char* name);
+
+/* backend_submit
+ *   runs a batch of reads (is_write 0) or writes (is_write 1) on dev, in
+ *   parallel if the backend can
+ * returns 0 if all of them succeed or -1 otherwise
+ */
+int backend_submit(struct disk_dev* dev, struct disk_io* ios, int count, int is_write);
+
+#endif // _DISK_BACKEND_H_
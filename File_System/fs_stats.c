@@ -0,0 +1,88 @@
+#include "fs_stats.h"
+#include <string.h>
+#include <time.h>
+
+int stats_enabled = 0;
+struct fs_stats stats_counters;
+
+static const char* op_names[NUM_FS_OPS] = {
+  "mkdir", "chdir", "ls", "rmdir", "creat", "remove", "stat", "write", "read", "compress", "rename", "fallocate"
+};
+
+
+void stats_enable(int enable) {
+  stats_enabled = enable != 0;
+}
+
+
+void stats_reset() {
+  memset(&stats_counters, 0, sizeof(stats_counters));
+}
+
+
+void stats_get(struct fs_stats* buf) {
+  *buf = stats_counters;
+}
+
+
+const char* stats_op_name(int op) {
+  return (op >= 0 && op < NUM_FS_OPS) ? op_names[op] : "unknown";
+}
+
+
+uint64_t stats_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+void stats_record_op(int op, uint64_t start, int ret) {
+  uint64_t ns = stats_now_ns() - start;
+  struct op_stats* s = &stats_counters.ops[op];
+  s->calls += 1;
+  if (ret != 0) {
+    s->errors += 1;
+  }
+  s->total_ns += ns;
+  if (ns > s->max_ns) {
+    s->max_ns = ns;
+  }
+
+  // the bucket is the position of the highest set bit
+  int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+  if (bucket >= STATS_BUCKETS) {
+    bucket = STATS_BUCKETS - 1;
+  }
+  s->hist[bucket] += 1;
+}
+
+
+void stats_print_json(FILE* out) {
+  struct fs_stats s;
+  stats_get(&s);
+  fprintf(out, "{\"enabled\":%s,", stats_enabled ? "true" : "false");
+  fprintf(out, "\"block_reads\":%lu,\"block_writes\":%lu,",
+          (unsigned long) s.block_reads, (unsigned long) s.block_writes);
+  fprintf(out, "\"bitmap_reads\":%lu,\"bitmap_writes\":%lu,",
+          (unsigned long) s.bitmap_reads, (unsigned long) s.bitmap_writes);
+  fprintf(out, "\"checksum_errors\":%lu,\"flushes\":%lu,",
+          (unsigned long) s.checksum_errors, (unsigned long) s.flushes);
+  fprintf(out, "\"bytes_read\":%lu,\"bytes_written\":%lu,\"ops\":{",
+          (unsigned long) s.bytes_read, (unsigned long) s.bytes_written);
+  for (int op = 0; op < NUM_FS_OPS; op++) {
+    struct op_stats* o = &s.ops[op];
+    fprintf(out, "%s\"%s\":{\"calls\":%lu,\"errors\":%lu,\"total_ns\":%lu,\"max_ns\":%lu,\"hist\":[",
+            op ? "," : "", op_names[op], (unsigned long) o->calls, (unsigned long) o->errors,
+            (unsigned long) o->total_ns, (unsigned long) o->max_ns);
+    int first = 1;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+      if (o->hist[b]) {
+        fprintf(out, "%s[%lu,%lu]", first ? "" : ",", 1ul << b, (unsigned long) o->hist[b]);
+        first = 0;
+      }
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "}}\n");
+}
@@ -0,0 +1,101 @@
+#ifndef _FS_STATS_H_
+#define _FS_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The jfs_* operations that are counted and timed
+enum fs_op {
+  OP_MKDIR,
+  OP_CHDIR,
+  OP_LS,
+  OP_RMDIR,
+  OP_CREAT,
+  OP_REMOVE,
+  OP_STAT,
+  OP_WRITE,
+  OP_READ,
+  OP_COMPRESS,
+  OP_RENAME,
+  OP_FALLOCATE,
+  NUM_FS_OPS
+};
+
+// latency histograms have one bucket per power of two nanoseconds: bucket i
+// counts calls that took [2^i, 2^(i+1)) ns, and the last one everything longer
+#define STATS_BUCKETS 32
+
+struct op_stats {
+  uint64_t calls;
+  uint64_t errors;   // calls that returned something other than E_SUCCESS
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t hist[STATS_BUCKETS];
+};
+
+struct fs_stats {
+  struct op_stats ops[NUM_FS_OPS];
+  uint64_t block_reads;   // read_block calls (all layers)
+  uint64_t block_writes;  // write_block calls (all layers)
+  uint64_t bitmap_reads;  // reads of the allocation bitmap in the superblock
+  uint64_t bitmap_writes; // writes of the allocation bitmap in the superblock
+  uint64_t checksum_errors; // blocks read from the disk that didn't match their checksum
+  uint64_t flushes;       // fdatasyncs (or other backend flushes) of the image
+  uint64_t bytes_read;    // file data returned by jfs_read
+  uint64_t bytes_written; // file data appended by jfs_write
+};
+
+// the counters are only touched while stats_enabled is set, so the
+// instrumentation costs a single branch when it is turned off
+extern int stats_enabled;
+extern struct fs_stats stats_counters;
+
+#define STATS_ADD(field, n) do { if (stats_enabled) stats_counters.field += (n); } while (0)
+#define STATS_INC(field) STATS_ADD(field, 1)
+
+
+/* stats_enable
+ *   turns collection on (nonzero) or off (0); the counters are kept either way
+ */
+void stats_enable(int enable);
+
+/* stats_reset
+ *   zeroes all counters and histograms
+ */
+void stats_reset();
+
+/* stats_get
+ *   copies the current counters into buf
+ */
+void stats_get(struct fs_stats* buf);
+
+/* stats_op_name
+ *   returns the name of an operation (the jfs_* function without the prefix)
+ */
+const char* stats_op_name(int op);
+
+/* stats_print_json
+ *   writes all counters to out as a single JSON object (histograms only list
+ *   their non-empty buckets, as [lower bound in ns, count] pairs)
+ */
+void stats_print_json(FILE* out);
+
+/* stats_op_begin / stats_op_end
+ *   time one call of an operation: stats_op_begin returns the start time (0
+ *   when collection is off) to pass to stats_op_end along with the result
+ *   (stats_now_ns and stats_record_op do the work when collection is on)
+ */
+uint64_t stats_now_ns();
+void stats_record_op(int op, uint64_t start, int ret);
+
+static inline uint64_t stats_op_begin() {
+  return stats_enabled ? stats_now_ns() : 0;
+}
+
+static inline void stats_op_end(int op, uint64_t start, int ret) {
+  if (stats_enabled && start != 0) {
+    stats_record_op(op, start, ret);
+  }
+}
+
+#endif // _FS_STATS_H_
@@ -0,0 +1,302 @@
+#include "jfs_client.h"
+#include "jfsd_protocol.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// a pipeline is sent in pieces of about this size, so neither side's
+// socket buffer fills up while the other one is still writing
+#define PIPELINE_CHUNK (32 * 1024)
+
+static int sock = -1;
+static uint32_t next_id = 0;
+
+// requests written but not sent yet
+static char* out = NULL;
+static size_t out_len = 0;
+static size_t out_cap = 0;
+
+// replies received but not handled yet
+static char in[64 * 1024];
+static size_t in_len = 0;
+static size_t in_off = 0;
+
+// while pipelining: the number of requests whose replies haven't been read,
+// and the results of the queued calls read so far
+static int pipelining = 0;
+static int unanswered = 0;
+static int* results = NULL;
+static int num_results = 0;
+static int results_cap = 0;
+
+
+int jfsc_connect(const char* socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path == NULL) {
+    socket_path = JFSD_SOCKET;
+  }
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(sock);
+    sock = -1;
+    return -1;
+  }
+  in_len = in_off = out_len = 0;
+  return 0;
+}
+
+
+static void put(const void* data, size_t len) {
+  if (out_len + len > out_cap) {
+    while (out_len + len > out_cap) {
+      out_cap = out_cap ? out_cap * 2 : 4096;
+    }
+    out = realloc(out, out_cap);
+  }
+  memcpy(out + out_len, data, len);
+  out_len += len;
+}
+
+
+// queues one request; the payload is a name (if not NULL) followed by len bytes of data
+static int queue(uint8_t op, const char* name, const void* data, size_t len) {
+  size_t name_len = name != NULL ? strlen(name) + 1 : 0;
+  if (sock < 0 || name_len + len > JFSD_MAX_PAYLOAD) {
+    return -1;
+  }
+  struct jfsd_request req = {op, 0, name_len + len, next_id++};
+  put(&req, sizeof(req));
+  if (name != NULL) {
+    put(name, name_len);
+  }
+  put(data, len);
+  unanswered++;
+  return 0;
+}
+
+
+static int send_queued() {
+  for (size_t off = 0; off < out_len; ) {
+    ssize_t n = write(sock, out + off, out_len - off);
+    if (n < 0 && errno != EINTR) {
+      return -1;
+    }
+    off += n > 0 ? n : 0;
+  }
+  out_len = 0;
+  return 0;
+}
+
+
+// copies the next len received bytes to buf, reading more from the socket as needed
+static int get(void* buf, size_t len) {
+  while (in_len - in_off < len) {
+    memmove(in, in + in_off, in_len - in_off);
+    in_len -= in_off;
+    in_off = 0;
+    ssize_t n = read(sock, in + in_len, sizeof(in) - in_len);
+    if (n == 0 || (n < 0 && errno != EINTR)) {
+      return -1;
+    }
+    in_len += n > 0 ? n : 0;
+  }
+  memcpy(buf, in + in_off, len);
+  in_off += len;
+  return 0;
+}
+
+
+// reads one reply; its payload goes to data (up to cap bytes, the rest is dropped)
+static int get_reply(void* data, size_t cap, size_t* len) {
+  struct jfsd_reply reply;
+  char payload[JFSD_MAX_PAYLOAD];
+  unanswered--;
+  if (get(&reply, sizeof(reply)) < 0 || reply.len > JFSD_MAX_PAYLOAD || get(payload, reply.len) < 0) {
+    return E_UNKNOWN;
+  }
+  if (data != NULL) {
+    *len = reply.len < cap ? reply.len : cap;
+    memcpy(data, payload, *len);
+  }
+  return reply.status;
+}
+
+
+static void add_result(int ret) {
+  if (num_results == results_cap) {
+    results_cap = results_cap ? results_cap * 2 : 64;
+    results = realloc(results, results_cap * sizeof(int));
+  }
+  results[num_results++] = ret;
+}
+
+
+// sends everything queued and reads the replies to the queued calls but the last `keep`
+static int flush_pipeline(int keep) {
+  if (send_queued() < 0) {
+    return -1;
+  }
+  while (unanswered > keep) {
+    add_result(get_reply(NULL, 0, NULL));
+  }
+  return 0;
+}
+
+
+// makes one call; with data set, the reply payload is copied there
+static int call(uint8_t op, const char* name, const void* arg, size_t arg_len,
+                void* data, size_t cap, size_t* len) {
+  if (queue(op, name, arg, arg_len) < 0) {
+    return E_UNKNOWN;
+  }
+  if (pipelining && data == NULL) {
+    return (out_len < PIPELINE_CHUNK || flush_pipeline(0) == 0) ? E_SUCCESS : E_UNKNOWN;
+  }
+  if (flush_pipeline(1) < 0) {
+    return E_UNKNOWN;
+  }
+  return get_reply(data, cap, len);
+}
+
+
+int jfsc_mkdir(const char* directory_name) {
+  return call(JFSD_MKDIR, directory_name, NULL, 0, NULL, 0, NULL);
+}
+
+
+int jfsc_chdir(const char* directory_name) {
+  return call(JFSD_CHDIR, directory_name, NULL, 0, NULL, 0, NULL);
+}
+
+
+// splits the names of an ls reply of the given type into a NULL terminated array
+static void ls_names(const char* reply, size_t len, char type, char* names[MAX_DIR_ENTRIES+1]) {
+  int n = 0;
+  for (size_t off = 0; off < len && n < (int) MAX_DIR_ENTRIES; ) {
+    const char* name = reply + off + 1;
+    if (reply[off] == type) {
+      names[n++] = strdup(name);
+    }
+    off += strlen(name) + 2;
+  }
+  names[n] = NULL;
+}
+
+
+int jfsc_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]) {
+  char reply[JFSD_MAX_PAYLOAD + 1];
+  size_t len = 0;
+  int ret = call(JFSD_LS, NULL, NULL, 0, reply, JFSD_MAX_PAYLOAD, &len);
+  reply[len] = '\0';
+  ls_names(reply, len, 'd', directories);
+  ls_names(reply, len, 'f', files);
+  return ret;
+}
+
+
+int jfsc_rmdir(const char* directory_name) {
+  return call(JFSD_RMDIR, directory_name, NULL, 0, NULL, 0, NULL);
+}
+
+
+int jfsc_creat(const char* file_name) {
+  return call(JFSD_CREAT, file_name, NULL, 0, NULL, 0, NULL);
+}
+
+
+int jfsc_remove(const char* file_name) {
+  return call(JFSD_REMOVE, file_name, NULL, 0, NULL, 0, NULL);
+}
+
+
+int jfsc_stat(const char* name, struct stats* buf) {
+  size_t len;
+  return call(JFSD_STAT, name, NULL, 0, buf, sizeof(*buf), &len);
+}
+
+
+int jfsc_write(const char* file_name, const void* buf, unsigned short count) {
+  return call(JFSD_WRITE, file_name, buf, count, NULL, 0, NULL);
+}
+
+
+int jfsc_read(const char* file_name, void* buf, unsigned short* count) {
+  uint16_t want = *count;
+  size_t len = 0;
+  int ret = call(JFSD_READ, file_name, &want, sizeof(want), buf, want, &len);
+  if (ret == E_SUCCESS) {
+    *count = len;
+  }
+  return ret;
+}
+
+
+int jfsc_compress(const char* file_name, int enable) {
+  uint8_t flag = enable != 0;
+  return call(JFSD_COMPRESS, file_name, &flag, sizeof(flag), NULL, 0, NULL);
+}
+
+
+int jfsc_rename(const char* src, const char* dst) {
+  return call(JFSD_RENAME, src, dst, strlen(dst) + 1, NULL, 0, NULL);
+}
+
+
+int jfsc_fallocate(const char* file_name, unsigned short size) {
+  uint16_t arg = size;
+  return call(JFSD_FALLOCATE, file_name, &arg, sizeof(arg), NULL, 0, NULL);
+}
+
+
+void jfsc_pipeline_begin() {
+  pipelining = 1;
+  num_results = 0;
+}
+
+
+int jfsc_pipeline_end(int* results_buf, int max_results) {
+  int failed = 0;
+  if (flush_pipeline(0) < 0) {
+    while (unanswered > 0) {
+      add_result(get_reply(NULL, 0, NULL));
+    }
+  }
+  for (int i = 0; i < num_results; i++) {
+    if (results_buf != NULL && i < max_results) {
+      results_buf[i] = results[i];
+    }
+    failed += results[i] != E_SUCCESS;
+  }
+  pipelining = 0;
+  num_results = 0;
+  return failed;
+}
+
+
+int jfsc_disconnect() {
+  if (pipelining) {
+    jfsc_pipeline_end(NULL, 0);
+  }
+  free(out);
+  free(results);
+  out = NULL;
+  results = NULL;
+  out_cap = results_cap = 0;
+  int ret = close(sock);
+  sock = -1;
+  return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef _JFS_CLIENT_H_
+#define _JFS_CLIENT_H_
+
+#include "jumbo_file_system.h"
+
+/* jfs_client talks to a running jfsd instead of mounting the image itself.
+ * The jfsc_* functions take the same arguments and return the same E_* codes
+ * as the jfs_* functions of the same name; E_UNKNOWN is also returned if the
+ * connection to the daemon fails.  Every connection has its own current
+ * directory, which starts out as the root directory.
+ */
+
+/* jfsc_connect
+ *   connects to the daemon listening on socket_path (JFSD_SOCKET if NULL)
+ * returns 0 on success or -1 on error (errno is set)
+ */
+int jfsc_connect(const char* socket_path);
+
+int jfsc_mkdir (const char* directory_name);
+int jfsc_chdir (const char* directory_name);
+int jfsc_ls (char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]);
+int jfsc_rmdir (const char* directory_name);
+int jfsc_creat (const char* file_name);
+int jfsc_remove (const char* file_name);
+int jfsc_stat (const char* name, struct stats* buf);
+int jfsc_write (const char* file_name, const void* buf, unsigned short count);
+int jfsc_read (const char* file_name, void* buf, unsigned short* count);
+int jfsc_compress (const char* file_name, int enable);
+int jfsc_rename (const char* src, const char* dst);
+int jfsc_fallocate (const char* file_name, unsigned short size);
+
+/* jfsc_pipeline_begin
+ *   from now on mkdir, chdir, rmdir, creat, remove, write, compress, rename and fallocate are
+ *   only queued and return E_SUCCESS straight away; the queue is sent in one
+ *   go when a call that returns data (ls, stat or read) is made or at
+ *   jfsc_pipeline_end
+ */
+void jfsc_pipeline_begin();
+
+/* jfsc_pipeline_end
+ *   sends what is still queued and waits for all the replies
+ * results - if not NULL, receives the return values of the queued calls
+ *   (in order; at most max_results of them)
+ * returns the number of queued calls that failed
+ */
+int jfsc_pipeline_end(int* results, int max_results);
+
+/* jfsc_disconnect
+ *   ends a pipeline that is still open and closes the connection
+ */
+int jfsc_disconnect();
+
+#endif // _JFS_CLIENT_H_
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "jumbo_file_system.h"
+
+/* jfs_export copies the whole tree of an image into a directory on the host.
+ * It goes through the jfs_* functions (so compressed files are decompressed)
+ * inside a transaction, which caches every block it reads: each block of the
+ * image is read from the DISK file at most once.
+ */
+
+// names of the directories from the root to the current one
+static char path[NUM_BLOCKS][MAX_NAME_LENGTH + 1];
+
+
+// makes the directory at the given depth of path the current directory again
+static int enter(int depth) {
+  jfs_chdir(NULL);
+  for (int i = 0; i < depth; i++) {
+    if (jfs_chdir(path[i]) != E_SUCCESS) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+// copies the current directory (at the given depth) into host_dir; returns the number of errors
+static int export_dir(const char* host_dir, int depth) {
+  if (mkdir(host_dir, 0777) < 0 && errno != EEXIST) {
+    perror(host_dir);
+    return 1;
+  }
+
+  char* directories[MAX_DIR_ENTRIES + 1];
+  char* files[MAX_DIR_ENTRIES + 1];
+  jfs_ls(directories, files);
+  int errors = 0;
+  char* host_path = malloc(strlen(host_dir) + MAX_NAME_LENGTH + 2);
+
+  for (int i = 0; files[i] != NULL; i++) {
+    char data[MAX_FILE_SIZE];
+    unsigned short count = MAX_FILE_SIZE;
+    sprintf(host_path, "%s/%s", host_dir, files[i]);
+    FILE* file = NULL;
+    if (jfs_read(files[i], data, &count) != E_SUCCESS
+        || (file = fopen(host_path, "wb")) == NULL
+        || fwrite(data, 1, count, file) != count) {
+      perror(host_path);
+      errors++;
+    }
+    if (file != NULL) {
+      fclose(file);
+    }
+    free(files[i]);
+  }
+
+  for (int i = 0; directories[i] != NULL; i++) {
+    sprintf(host_path, "%s/%s", host_dir, directories[i]);
+    strcpy(path[depth], directories[i]);
+    if (enter(depth + 1) < 0) {
+      fprintf(stderr, "%s: cannot enter directory\n", host_path);
+      errors++;
+    } else {
+      errors += export_dir(host_path, depth + 1);
+    }
+    enter(depth);
+    free(directories[i]);
+  }
+  free(host_path);
+  return errors;
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: jfs_export <image> <host_dir>\n");
+    return 2;
+  }
+  // mounting would create an empty image instead
+  if (raw_exists(argv[1]) < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  if (jfs_mount(argv[1]) < 0 || jfs_begin() != E_SUCCESS) {
+    perror(argv[1]);
+    return 1;
+  }
+  int errors = export_dir(argv[2], 0);
+  jfs_commit();
+  jfs_unmount();
+  return errors ? 1 : 0;
+}
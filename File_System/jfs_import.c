@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "jumbo_file_system.h"
+
+/* jfs_import builds a new image from a directory tree on the host in one
+ * pass: the whole tree is read and checked against the file system limits
+ * first, every block is then assigned up front (the entries of a directory
+ * get consecutive blocks, each inode followed by its data blocks, and then
+ * the subdirectories are laid out the same way), and the image is written
+ * front to back inside a single raw_begin()/raw_commit(), so the
+ * bitmap and every other block are written exactly once.
+ */
+
+struct node {
+  char name[MAX_NAME_LENGTH + 1];
+  int is_dir;
+  block_num_t block_num;          // dir block or inode
+  block_num_t first_data;         // first data block (regular files)
+  uint32_t size;                  // file size in bytes (regular files)
+  char* data;                     // file contents (regular files)
+  int num_children;
+  struct node* children[MAX_DIR_ENTRIES];
+};
+
+static char image[NUM_BLOCKS][BLOCK_SIZE];
+static block_num_t next_block = 2; // 0 is the superblock and 1 the root directory
+
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp((*(struct node* const*) a)->name, (*(struct node* const*) b)->name);
+}
+
+
+// reads a host file or directory (recursively) into a tree of nodes; returns NULL on error
+static struct node* scan(const char* path, const char* name, int is_root) {
+  struct stat st;
+  if (lstat(path, &st) < 0) {
+    perror(path);
+    return NULL;
+  }
+  if (!is_root && strlen(name) > MAX_NAME_LENGTH) {
+    fprintf(stderr, "%s: name is longer than %d characters\n", path, MAX_NAME_LENGTH);
+    return NULL;
+  }
+  struct node* node = calloc(1, sizeof(struct node));
+  strncpy(node->name, is_root ? "" : name, MAX_NAME_LENGTH);
+
+  if (S_ISREG(st.st_mode)) {
+    if (st.st_size > (off_t) MAX_FILE_SIZE) {
+      fprintf(stderr, "%s: file is larger than %d bytes\n", path, (int) MAX_FILE_SIZE);
+      return NULL;
+    }
+    FILE* file = fopen(path, "rb");
+    node->size = st.st_size;
+    node->data = malloc(node->size + 1);
+    if (file == NULL || fread(node->data, 1, node->size, file) != node->size) {
+      perror(path);
+      return NULL;
+    }
+    fclose(file);
+    return node;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "%s: only regular files and directories can be imported\n", path);
+    return NULL;
+  }
+
+  node->is_dir = 1;
+  DIR* dir = opendir(path);
+  if (dir == NULL) {
+    perror(path);
+    return NULL;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    if (node->num_children == (int) MAX_DIR_ENTRIES) {
+      fprintf(stderr, "%s: directory has more than %d entries\n", path, (int) MAX_DIR_ENTRIES);
+      return NULL;
+    }
+    char* child_path = malloc(strlen(path) + strlen(entry->d_name) + 2);
+    sprintf(child_path, "%s/%s", path, entry->d_name);
+    struct node* child = scan(child_path, entry->d_name, 0);
+    free(child_path);
+    if (child == NULL) {
+      return NULL;
+    }
+    node->children[node->num_children++] = child;
+  }
+  closedir(dir);
+  qsort(node->children, node->num_children, sizeof(struct node*), compare_names);
+  return node;
+}
+
+
+// assigns blocks to the children of a directory, then to their subtrees; returns -1 if the disk is too small
+static int plan(struct node* dir) {
+  for (int i = 0; i < dir->num_children; i++) {
+    struct node* child = dir->children[i];
+    uint32_t data_blocks = (child->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (next_block + 1 + data_blocks > XSB_BLOCK) {
+      return -1;
+    }
+    child->block_num = next_block++;
+    child->first_data = next_block;
+    next_block += data_blocks;
+  }
+  for (int i = 0; i < dir->num_children; i++) {
+    if (dir->children[i]->is_dir && plan(dir->children[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+// fills in the image blocks of a directory and everything below it
+static void lay_out(struct node* dir) {
+  struct block* dirnode = (struct block*) image[dir->block_num];
+  dirnode->is_dir = 0;
+  dirnode->contents.dirnode.num_entries = dir->num_children;
+  for (int i = 0; i < dir->num_children; i++) {
+    struct node* child = dir->children[i];
+    dirnode->contents.dirnode.entries[i].block_num = child->block_num;
+    strncpy(dirnode->contents.dirnode.entries[i].name, child->name, MAX_NAME_LENGTH + 1);
+    if (child->is_dir) {
+      lay_out(child);
+      continue;
+    }
+    struct block* inode = (struct block*) image[child->block_num];
+    inode->is_dir = 1;
+    inode->contents.inode.file_size = child->size;
+    uint32_t data_blocks = (child->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (uint32_t k = 0; k < data_blocks; k++) {
+      inode->contents.inode.data_blocks[k] = child->first_data + k;
+      memset(image[child->first_data + k], -1, BLOCK_SIZE);
+    }
+    memcpy(image[child->first_data], child->data, child->size);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: jfs_import <host_dir> <image>\n(the image is created from scratch)\n");
+    return 2;
+  }
+
+  struct node* root = scan(argv[1], "", 1);
+  if (root == NULL) {
+    return 1;
+  }
+  if (!root->is_dir) {
+    fprintf(stderr, "%s: not a directory\n", argv[1]);
+    return 1;
+  }
+  root->block_num = 1;
+  if (plan(root) < 0) {
+    fprintf(stderr, "%s: does not fit in an image of %d blocks\n", argv[1], NUM_BLOCKS);
+    return 1;
+  }
+  lay_out(root);
+
+  // the bitmap covers the blocks that were handed out plus the extended superblock
+  char* superblock = image[0];
+  for (block_num_t b = 0; b < next_block; b++) {
+    superblock[b / 8] |= 1 << (b % 8);
+  }
+  superblock[XSB_BLOCK / 8] |= 1 << (XSB_BLOCK % 8);
+  struct xsuperblock* xsb = (struct xsuperblock*) image[XSB_BLOCK];
+  memcpy(xsb->magic, XSB_MAGIC, sizeof(xsb->magic));
+
+  raw_remove(argv[2]);
+  if (raw_mount(argv[2]) < 0 || raw_begin() < 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    write_block(b, image[b]);
+  }
+  if (raw_commit() < 0 || raw_unmount() < 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %d blocks used of %d\n", argv[2], next_block + 1, NUM_BLOCKS);
+  return 0;
+}
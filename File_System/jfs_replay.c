@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jumbo_file_system.h"
+#include "fs_stats.h"
+#include "trace.h"
+
+/* jfs_replay runs the calls of a trace (see trace.h) again, one after the
+ * other and as fast as it can, on a fresh image or on a copy of a snapshot
+ * of one.  It prints one JSON object per line: one for every kind of call in
+ * the trace, with the latencies of the replay next to the traced ones, and a
+ * summary.  A call that returns something other than what it returned when
+ * it was traced counts as a mismatch (the replay has diverged from the
+ * original run, e.g. because it didn't start from the same image).
+ */
+
+#define REPLAY_DISK "REPLAY_DISK"
+
+struct call {
+  struct trace_record rec;
+  char* payload;
+};
+
+// latencies of one kind of call
+struct samples {
+  uint64_t* replayed;
+  uint64_t* traced;
+  int count;
+  int cap;
+  int mismatches;
+};
+
+static struct samples samples[NUM_TRACE_OPS];
+
+
+// reads the whole trace into memory, so that reading it isn't part of the replay
+static struct call* load_trace(const char* path, int* num_calls) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return NULL;
+  }
+  char magic[4];
+  uint32_t version;
+  if (fread(magic, 4, 1, f) != 1 || memcmp(magic, TRACE_MAGIC, 4) != 0
+      || fread(&version, sizeof(version), 1, f) != 1 || version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a trace\n", path);
+    fclose(f);
+    return NULL;
+  }
+  struct call* calls = NULL;
+  int n = 0, cap = 0;
+  struct trace_record rec;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      calls = realloc(calls, cap * sizeof(*calls));
+    }
+    calls[n].rec = rec;
+    // one extra NUL, so a truncated name still ends
+    calls[n].payload = calloc(rec.payload + 1, 1);
+    if (rec.op >= NUM_TRACE_OPS || fread(calls[n].payload, 1, rec.payload, f) != rec.payload) {
+      fprintf(stderr, "%s: cut off or damaged after %d calls\n", path, n);
+      free(calls[n].payload);
+      break;
+    }
+    n++;
+  }
+  fclose(f);
+  *num_calls = n;
+  return calls;
+}
+
+
+// copies an image block by block (through the disk backends, so both can be any kind of disk)
+static int copy_image(const char* from, const char* to) {
+  static char image[NUM_BLOCKS][BLOCK_SIZE];
+  if (raw_mount(from) < 0) {
+    return -1;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    if (read_block(b, image[b]) < 0) {
+      raw_unmount();
+      return -1;
+    }
+  }
+  raw_unmount();
+  raw_remove(to);
+  if (raw_mount(to) < 0) {
+    return -1;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    if (write_block(b, image[b]) < 0) {
+      raw_unmount();
+      return -1;
+    }
+  }
+  return raw_unmount();
+}
+
+
+// runs one traced call
+static int replay(const struct call* c) {
+  const struct trace_record* r = &c->rec;
+  const char* name = c->payload;
+  const char* name2 = c->payload + strlen(c->payload) + 1;
+  switch (r->op) {
+  case OP_MKDIR:
+    return jfs_mkdir(name);
+  case OP_CHDIR:
+    return jfs_chdir(r->payload ? name : NULL);
+  case OP_LS: {
+    char* directories[MAX_DIR_ENTRIES + 1];
+    char* files[MAX_DIR_ENTRIES + 1];
+    int ret = jfs_ls(directories, files);
+    for (int i = 0; ret == E_SUCCESS && directories[i] != NULL; i++) {
+      free(directories[i]);
+    }
+    for (int i = 0; ret == E_SUCCESS && files[i] != NULL; i++) {
+      free(files[i]);
+    }
+    return ret;
+  }
+  case OP_RMDIR:
+    return jfs_rmdir(name);
+  case OP_CREAT:
+    return jfs_creat(name);
+  case OP_REMOVE:
+    return jfs_remove(name);
+  case OP_STAT: {
+    struct stats st;
+    return jfs_stat(name, &st);
+  }
+  case OP_WRITE:
+    return jfs_write(name, name2, r->count);
+  case OP_READ: {
+    char buf[MAX_FILE_SIZE];
+    unsigned short count = r->count < MAX_FILE_SIZE ? r->count : MAX_FILE_SIZE;
+    return jfs_read(name, buf, &count);
+  }
+  case OP_COMPRESS:
+    return jfs_compress(name, r->arg);
+  case OP_RENAME:
+    return jfs_rename(name, name2);
+  case OP_FALLOCATE:
+    return jfs_fallocate(name, r->count);
+  case TRACE_SYNC:
+    return jfs_sync();
+  case TRACE_BEGIN:
+    return jfs_begin();
+  case TRACE_COMMIT:
+    return jfs_commit();
+  case TRACE_SETCWD:
+    return jfs_setcwd(r->count);
+  case TRACE_DEDUP:
+    return jfs_dedup(r->arg);
+  case TRACE_CHECKSUMS:
+    return jfs_checksums(r->arg);
+  case TRACE_DEFER:
+    return jfs_defer_release(r->arg);
+  case TRACE_DURABILITY: {
+    uint32_t interval = 0;
+    if (r->payload == sizeof(interval)) {
+      memcpy(&interval, c->payload, sizeof(interval));
+    }
+    return jfs_durability(r->arg, interval);
+  }
+  }
+  return E_UNKNOWN;
+}
+
+
+static void add_sample(int op, uint64_t replayed, uint64_t traced, int mismatch) {
+  struct samples* s = &samples[op];
+  if (s->count == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 256;
+    s->replayed = realloc(s->replayed, s->cap * sizeof(uint64_t));
+    s->traced = realloc(s->traced, s->cap * sizeof(uint64_t));
+  }
+  s->replayed[s->count] = replayed;
+  s->traced[s->count] = traced;
+  s->count++;
+  s->mismatches += mismatch;
+}
+
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+
+static uint64_t percentile(uint64_t* v, int n, int p) {
+  return n ? v[(n * p) / 100 < n ? (n * p) / 100 : n - 1] : 0;
+}
+
+
+static void usage() {
+  fprintf(stderr, "usage: jfs_replay [-d disk] [-s snapshot] <trace>\n");
+  fprintf(stderr, "  -d disk      the image to replay on (default %s; any disk of disk_backend.h)\n", REPLAY_DISK);
+  fprintf(stderr, "  -s snapshot  start from a copy of this image instead of an empty one\n");
+  exit(2);
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* disk_name = REPLAY_DISK;
+  const char* snapshot = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:")) != -1) {
+    switch (opt) {
+    case 'd':
+      disk_name = optarg;
+      break;
+    case 's':
+      snapshot = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  int num_calls = 0;
+  struct call* calls = load_trace(argv[optind], &num_calls);
+  if (calls == NULL) {
+    return 1;
+  }
+  if (snapshot != NULL && copy_image(snapshot, disk_name) < 0) {
+    perror(snapshot);
+    return 1;
+  }
+  if (snapshot == NULL) {
+    raw_remove(disk_name);
+  }
+  if (jfs_mount(disk_name) < 0) {
+    perror(disk_name);
+    return 1;
+  }
+
+  stats_reset();
+  stats_enable(1);
+  int mismatches = 0;
+  uint64_t run_start = stats_now_ns();
+  for (int i = 0; i < num_calls; i++) {
+    uint64_t start = stats_now_ns();
+    int ret = replay(&calls[i]);
+    uint64_t ns = stats_now_ns() - start;
+    int mismatch = ret != calls[i].rec.ret;
+    mismatches += mismatch;
+    add_sample(calls[i].rec.op, ns, calls[i].rec.duration_ns, mismatch);
+  }
+  uint64_t elapsed = stats_now_ns() - run_start;
+  stats_enable(0);
+  struct fs_stats io;
+  stats_get(&io);
+
+  for (int op = 0; op < NUM_TRACE_OPS; op++) {
+    struct samples* s = &samples[op];
+    if (s->count == 0) {
+      continue;
+    }
+    qsort(s->replayed, s->count, sizeof(uint64_t), compare_u64);
+    qsort(s->traced, s->count, sizeof(uint64_t), compare_u64);
+    printf("{\"op\":\"%s\",\"calls\":%d,\"mismatches\":%d,"
+           "\"p50_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu,"
+           "\"traced_p50_ns\":%lu,\"traced_p99_ns\":%lu,\"traced_max_ns\":%lu}\n",
+           trace_op_name(op), s->count, s->mismatches,
+           (unsigned long) percentile(s->replayed, s->count, 50),
+           (unsigned long) percentile(s->replayed, s->count, 99),
+           (unsigned long) s->replayed[s->count - 1],
+           (unsigned long) percentile(s->traced, s->count, 50),
+           (unsigned long) percentile(s->traced, s->count, 99),
+           (unsigned long) s->traced[s->count - 1]);
+  }
+  double ops = num_calls ? num_calls : 1;
+  printf("{\"replay\":\"%s\",\"calls\":%d,\"mismatches\":%d,\"calls_per_sec\":%.0f,"
+         "\"block_reads_per_call\":%.2f,\"block_writes_per_call\":%.2f,\"bitmap_ios_per_call\":%.2f,"
+         "\"flushes_per_call\":%.2f}\n",
+         argv[optind], num_calls, mismatches, num_calls / (elapsed / 1e9),
+         io.block_reads / ops, io.block_writes / ops, (io.bitmap_reads + io.bitmap_writes) / ops,
+         io.flushes / ops);
+
+  jfs_unmount();
+  for (int i = 0; i < num_calls; i++) {
+    free(calls[i].payload);
+  }
+  free(calls);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "jumbo_file_system.h"
+#include "jfsd_protocol.h"
+#include "trace.h"
+
+/* jfsd mounts an image once and serves it to local clients over a Unix
+ * domain socket (see jfsd_protocol.h, and jfs_client.h for the client side).
+ * The image is mounted shared, so the blocks stay in the shared block cache
+ * between clients and command_line -s can still work on it at the same time.
+ * Every client has its own current directory, which is switched in with
+ * jfs_setcwd() for each of its requests.  The daemon is a single poll() loop:
+ * for every client it reads whatever has arrived, runs all the complete
+ * requests in it, and sends all their replies with a single write.
+ */
+
+#define MAX_CLIENTS 64
+#define IN_BUF_SIZE (64 * 1024)
+
+struct client {
+  int fd;
+  block_num_t cwd;
+  char* in;             // received bytes not yet handled
+  size_t in_len;
+  char* out;            // replies not yet sent
+  size_t out_len;
+  size_t out_cap;
+  size_t out_off;       // bytes of out already sent
+};
+
+static struct client clients[MAX_CLIENTS];
+static int num_clients = 0;
+static volatile sig_atomic_t stop = 0;
+
+
+static void handle_signal(int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+
+static void append_out(struct client* c, const void* data, size_t len) {
+  if (c->out_len + len > c->out_cap) {
+    while (c->out_len + len > c->out_cap) {
+      c->out_cap = c->out_cap ? c->out_cap * 2 : 4096;
+    }
+    c->out = realloc(c->out, c->out_cap);
+  }
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+}
+
+
+// returns the NUL terminated name at the start of a payload, or NULL if there is none
+static const char* payload_name(const char* payload, uint16_t len) {
+  const char* end = memchr(payload, '\0', len);
+  return (end != NULL && end > payload) ? payload : NULL;
+}
+
+
+// adds one entry per name to an ls reply and frees the names
+static void ls_entries(char** names, char type, char* reply, uint16_t* len) {
+  for (int i = 0; names[i] != NULL; i++) {
+    reply[(*len)++] = type;
+    size_t n = strlen(names[i]) + 1;
+    memcpy(reply + *len, names[i], n);
+    *len += n;
+    free(names[i]);
+  }
+}
+
+
+// runs one request in the client's current directory and queues the reply
+static void serve(struct client* c, const struct jfsd_request* req, const char* payload) {
+  static char reply[JFSD_MAX_PAYLOAD];
+  struct jfsd_reply hdr = {E_UNKNOWN, 0, req->id};
+  const char* name = payload_name(payload, req->len);
+  size_t name_len = name != NULL ? strlen(name) + 1 : 0;
+  int ret = E_UNKNOWN;
+
+  if (jfs_setcwd(c->cwd) != E_SUCCESS && !(req->op == JFSD_CHDIR && req->len == 0)) {
+    ret = E_NOT_EXISTS;
+    goto done;
+  }
+
+  switch (req->op) {
+  case JFSD_MKDIR:
+    ret = name ? jfs_mkdir(name) : E_UNKNOWN;
+    break;
+  case JFSD_CHDIR:
+    ret = req->len == 0 ? jfs_chdir(NULL) : name ? jfs_chdir(name) : E_UNKNOWN;
+    break;
+  case JFSD_LS: {
+    char* directories[MAX_DIR_ENTRIES + 1];
+    char* files[MAX_DIR_ENTRIES + 1];
+    ret = jfs_ls(directories, files);
+    if (ret == E_SUCCESS) {
+      ls_entries(directories, 'd', reply, &hdr.len);
+      ls_entries(files, 'f', reply, &hdr.len);
+    }
+    break;
+  }
+  case JFSD_RMDIR:
+    ret = name ? jfs_rmdir(name) : E_UNKNOWN;
+    break;
+  case JFSD_CREAT:
+    ret = name ? jfs_creat(name) : E_UNKNOWN;
+    break;
+  case JFSD_REMOVE:
+    ret = name ? jfs_remove(name) : E_UNKNOWN;
+    break;
+  case JFSD_STAT: {
+    struct stats st;
+    ret = name ? jfs_stat(name, &st) : E_UNKNOWN;
+    if (ret == E_SUCCESS) {
+      memcpy(reply, &st, sizeof(st));
+      hdr.len = sizeof(st);
+    }
+    break;
+  }
+  case JFSD_WRITE:
+    ret = name ? jfs_write(name, payload + name_len, req->len - name_len) : E_UNKNOWN;
+    break;
+  case JFSD_READ: {
+    uint16_t count;
+    if (name == NULL || req->len != name_len + sizeof(count)) {
+      break;
+    }
+    memcpy(&count, payload + name_len, sizeof(count));
+    unsigned short n = count < sizeof(reply) ? count : sizeof(reply);
+    ret = jfs_read(name, reply, &n);
+    if (ret == E_SUCCESS) {
+      hdr.len = n;
+    }
+    break;
+  }
+  case JFSD_COMPRESS:
+    if (name != NULL && req->len == name_len + 1) {
+      ret = jfs_compress(name, payload[name_len]);
+    }
+    break;
+  case JFSD_FALLOCATE: {
+    uint16_t size;
+    if (name == NULL || req->len != name_len + sizeof(size)) {
+      break;
+    }
+    memcpy(&size, payload + name_len, sizeof(size));
+    ret = jfs_fallocate(name, size);
+    break;
+  }
+  case JFSD_RENAME: {
+    const char* dst = name ? payload_name(payload + name_len, req->len - name_len) : NULL;
+    ret = dst ? jfs_rename(name, dst) : E_UNKNOWN;
+    break;
+  }
+  }
+  c->cwd = jfs_getcwd();
+
+done:
+  hdr.status = ret;
+  if (ret != E_SUCCESS) {
+    hdr.len = 0;
+  }
+  append_out(c, &hdr, sizeof(hdr));
+  append_out(c, reply, hdr.len);
+}
+
+
+static void drop_client(int i) {
+  close(clients[i].fd);
+  free(clients[i].in);
+  free(clients[i].out);
+  clients[i] = clients[--num_clients];
+}
+
+
+// sends as much of the queued replies as the socket takes; returns -1 if the client is gone
+static int flush_client(struct client* c) {
+  while (c->out_off < c->out_len) {
+    ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+    if (n < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    c->out_off += n;
+  }
+  c->out_len = c->out_off = 0;
+  return 0;
+}
+
+
+// reads what the client sent and runs every complete request; returns -1 if the client is gone
+static int read_client(struct client* c) {
+  ssize_t n = read(c->fd, c->in + c->in_len, IN_BUF_SIZE - c->in_len);
+  if (n <= 0) {
+    return (n < 0 && (errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+  }
+  c->in_len += n;
+
+  size_t off = 0;
+  while (c->in_len - off >= sizeof(struct jfsd_request)) {
+    struct jfsd_request req;
+    memcpy(&req, c->in + off, sizeof(req));
+    if (req.len > JFSD_MAX_PAYLOAD) {
+      return -1;
+    }
+    if (c->in_len - off < sizeof(req) + req.len) {
+      break;
+    }
+    serve(c, &req, c->in + off + sizeof(req));
+    off += sizeof(req) + req.len;
+  }
+  memmove(c->in, c->in + off, c->in_len - off);
+  c->in_len -= off;
+  return flush_client(c);
+}
+
+
+static int open_socket(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* socket_path = JFSD_SOCKET;
+  const char* trace_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:T:")) != -1) {
+    if (opt == 's') {
+      socket_path = optarg;
+    } else if (opt == 'T') {
+      trace_path = optarg;
+    } else {
+      fprintf(stderr, "usage: jfsd [-s socket] [-T trace] <image>\n");
+      return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: jfsd [-s socket] [-T trace] <image>\n");
+    return 2;
+  }
+  // the calls of all clients go into one trace, in the order they were served
+  if (trace_path != NULL && trace_open(trace_path) < 0) {
+    perror(trace_path);
+    return 1;
+  }
+
+  if (jfs_mount_shared(argv[optind]) < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  int listen_fd = open_socket(socket_path);
+  if (listen_fd < 0) {
+    perror(socket_path);
+    jfs_unmount();
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  struct pollfd fds[MAX_CLIENTS + 1];
+  while (!stop) {
+    fds[0].fd = listen_fd;
+    fds[0].events = num_clients < MAX_CLIENTS ? POLLIN : 0;
+    for (int i = 0; i < num_clients; i++) {
+      // a client that isn't taking its replies isn't served until it does
+      fds[i + 1].fd = clients[i].fd;
+      fds[i + 1].events = clients[i].out_len > 0 ? POLLOUT : POLLIN;
+    }
+    if (poll(fds, num_clients + 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+
+    // back to front, so dropping a client doesn't move one that is yet to be looked at
+    for (int i = num_clients - 1; i >= 0; i--) {
+      short revents = fds[i + 1].revents;
+      int ret = 0;
+      if (revents & POLLOUT) {
+        ret = flush_client(&clients[i]);
+      } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        ret = read_client(&clients[i]);
+      }
+      if (ret < 0) {
+        drop_client(i);
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        struct client* c = &clients[num_clients++];
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->cwd = 1;
+        c->in = malloc(IN_BUF_SIZE);
+      }
+    }
+  }
+
+  while (num_clients > 0) {
+    drop_client(num_clients - 1);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  jfs_unmount();
+  if (trace_close() < 0) {
+    fprintf(stderr, "jfsd: the trace could not be written completely\n");
+  }
+  return 0;
+}
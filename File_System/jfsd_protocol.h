@@ -0,0 +1,63 @@
+#ifndef _JFSD_PROTOCOL_H_
+#define _JFSD_PROTOCOL_H_
+
+#include <stdint.h>
+
+/* The request protocol spoken between jfsd and jfs_client over a Unix domain
+ * socket.  Both ends run on the same machine, so all fields are in host byte
+ * order.  Every message is a fixed header followed by len bytes of payload.
+ * A client may send any number of requests without waiting (pipelining); the
+ * daemon answers them in order, and the replies to all the requests it found
+ * in one read go back in one write.
+ *
+ * request payloads (names are NUL terminated):
+ *   MKDIR, RMDIR, CREAT, REMOVE, STAT   name
+ *   CHDIR                               name, or nothing for the root directory
+ *   LS                                  nothing
+ *   WRITE                               name, data
+ *   READ                                name, uint16_t count
+ *   COMPRESS                            name, uint8_t enable
+ *   RENAME                              source path, destination path
+ *   FALLOCATE                           name, uint16_t size
+ *
+ * reply payloads (only sent when status is E_SUCCESS):
+ *   LS     for every entry: 'd' or 'f', name (directories first)
+ *   STAT   struct stats
+ *   READ   the data that was read
+ *   others nothing
+ */
+
+#define JFSD_SOCKET "jfsd.sock"
+
+// largest payload of a single message (a full-size write plus its name)
+#define JFSD_MAX_PAYLOAD 4096
+
+enum jfsd_op {
+  JFSD_MKDIR = 1,
+  JFSD_CHDIR,
+  JFSD_LS,
+  JFSD_RMDIR,
+  JFSD_CREAT,
+  JFSD_REMOVE,
+  JFSD_STAT,
+  JFSD_WRITE,
+  JFSD_READ,
+  JFSD_COMPRESS,
+  JFSD_RENAME,
+  JFSD_FALLOCATE,
+};
+
+struct jfsd_request {
+  uint8_t op;
+  uint8_t pad;
+  uint16_t len;   // payload bytes that follow
+  uint32_t id;    // copied into the reply
+};
+
+struct jfsd_reply {
+  int16_t status; // E_SUCCESS or one of the E_* codes
+  uint16_t len;   // payload bytes that follow
+  uint32_t id;
+};
+
+#endif // _JFSD_PROTOCOL_H_
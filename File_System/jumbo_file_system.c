@@ -1,4 +1,8 @@
 #include "jumbo_file_system.h"
+#include "compress.h"
+#include "dedup.h"
+#include "fs_stats.h"
+#include "trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +15,10 @@ typedef char bool_t;
 
 static block_num_t current_dir;
 
+// TRUE while full data blocks written by jfs_write are deduplicated
+static bool_t dedup_on;
+static int sync_mode = JFS_SYNC_NONE;
+
 
 // optional helper function you can implement to tell you if a block is a dir node or an inode
 static bool_t is_dir(block_num_t block_num) {
@@ -27,6 +35,397 @@ static bool_t is_dir(block_num_t block_num) {
 }
 
 
+// number of blocks needed to hold size bytes
+static uint32_t blocks_for(uint32_t size) {
+  return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+
+// number of bytes of a file that fall into compression group g
+static uint32_t group_length(uint32_t file_size, uint32_t g) {
+  if (file_size <= g * COMPRESS_GROUP_SIZE) {
+    return 0;
+  }
+  uint32_t len = file_size - g * COMPRESS_GROUP_SIZE;
+  return len < COMPRESS_GROUP_SIZE ? len : COMPRESS_GROUP_SIZE;
+}
+
+
+// number of blocks that are currently stored for compression group g
+static uint32_t group_blocks(struct block *inode, uint32_t g) {
+  uint32_t n = 0;
+  while(n < COMPRESS_GROUP_BLOCKS && inode->contents.inode.data_blocks[g * COMPRESS_GROUP_BLOCKS + n] != 0){
+    n += 1;
+  }
+  return n;
+}
+
+
+// number of data blocks used by a file (not counting the inode)
+static uint32_t inode_num_blocks(struct block *inode) {
+  if(!(inode->contents.inode.flags & JFS_COMPRESSED)){
+    return blocks_for(inode->contents.inode.file_size);
+  }
+  uint32_t n = 0;
+  for(uint32_t k = 0; k < MAX_DATA_BLOCKS; k++){
+    if(inode->contents.inode.data_blocks[k] != 0){
+      n += 1;
+    }
+  }
+  return n;
+}
+
+
+// releases one reference to a data block, dropping it from the dedup index
+// when it is the last one
+static void release_data_block(block_num_t block_num) {
+  if(block_refs(block_num) == 1){
+    dedup_forget(block_num);
+  }
+  release_block(block_num);
+}
+
+
+// releases all of the data blocks of a file (and the ones preallocated for
+// it), and the inode itself if
+// inode_num isn't 0, with a single update of the bitmap
+static void inode_release_blocks(struct block *inode, block_num_t inode_num) {
+  block_num_t blocks[MAX_DATA_BLOCKS + 1];
+  char freed[MAX_DATA_BLOCKS + 1];
+  int n = 0;
+  for(uint32_t j = 0; j < MAX_DATA_BLOCKS; j++){
+    if(inode->contents.inode.flags & JFS_COMPRESSED){
+      if(inode->contents.inode.data_blocks[j] != 0){
+        blocks[n++] = inode->contents.inode.data_blocks[j];
+      }
+    }else if(j < blocks_for(inode->contents.inode.file_size) + inode->contents.inode.prealloc){
+      blocks[n++] = inode->contents.inode.data_blocks[j];
+    }
+  }
+  if(inode_num != 0){
+    blocks[n++] = inode_num;
+  }
+  release_blocks(blocks, n, freed);
+  //the blocks that are gone can't be shared any more
+  for(int j = 0; j < n; j++){
+    if(freed[j]){
+      dedup_forget(blocks[j]);
+    }
+  }
+}
+
+
+// reads and decompresses group g of a compressed file into out (COMPRESS_GROUP_SIZE bytes)
+static int group_load(struct block *inode, uint32_t g, char *out) {
+  uint32_t len = group_length(inode->contents.inode.file_size, g);
+  uint32_t n = group_blocks(inode, g);
+  char packed[COMPRESS_GROUP_SIZE];
+  if(read_blocks(&inode->contents.inode.data_blocks[g * COMPRESS_GROUP_BLOCKS], n, packed) < 0){
+    return E_UNKNOWN;
+  }
+  if(n == blocks_for(len)){
+    //the group did not compress, so it is stored as is
+    memcpy(out, packed, len);
+    return E_SUCCESS;
+  }
+  int packed_len = (unsigned char) packed[0] | ((unsigned char) packed[1] << 8);
+  if(packed_len > (int) (n * BLOCK_SIZE - 2)
+     || lz_decompress(packed + 2, packed_len, out, COMPRESS_GROUP_SIZE) != (int) len){
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+
+// compresses len bytes of a group into packed; returns the number of blocks it needs
+static uint32_t group_pack(const char *plain, uint32_t len, char *packed) {
+  uint32_t raw_blocks = blocks_for(len);
+  memset(packed, -1, COMPRESS_GROUP_SIZE);
+  if(raw_blocks > 1){
+    //only keep the compressed form if it saves at least one block
+    int packed_len = lz_compress(plain, len, packed + 2, (raw_blocks - 1) * BLOCK_SIZE - 2);
+    if(packed_len > 0){
+      packed[0] = packed_len & 0xff;
+      packed[1] = packed_len >> 8;
+      return blocks_for(packed_len + 2);
+    }
+    memset(packed, -1, COMPRESS_GROUP_SIZE);
+  }
+  memcpy(packed, plain, len);
+  return raw_blocks;
+}
+
+
+// copies the first count bytes of a file into buf (count must not exceed the file size)
+static int file_read_data(struct block *inode, void *buf, uint32_t count) {
+  if(!(inode->contents.inode.flags & JFS_COMPRESSED)){
+    uint32_t data_block_total = blocks_for(count);
+    char *data = malloc(BLOCK_SIZE * (data_block_total + 1));
+    int ret = read_blocks(inode->contents.inode.data_blocks, data_block_total, data);
+    memcpy(buf, data, count);
+    free(data);
+    return ret < 0 ? E_UNKNOWN : E_SUCCESS;
+  }
+  //only the groups that overlap the requested range are decompressed
+  char plain[COMPRESS_GROUP_SIZE];
+  for(uint32_t g = 0; g * COMPRESS_GROUP_SIZE < count; g++){
+    int ret = group_load(inode, g, plain);
+    if(ret != E_SUCCESS){
+      return ret;
+    }
+    uint32_t len = count - g * COMPRESS_GROUP_SIZE;
+    if(len > COMPRESS_GROUP_SIZE){
+      len = COMPRESS_GROUP_SIZE;
+    }
+    memcpy((char *) buf + g * COMPRESS_GROUP_SIZE, plain, len);
+  }
+  return E_SUCCESS;
+}
+
+
+// allocates count blocks into blocks[], releasing them all again if the disk fills up
+static int allocate_blocks(block_num_t *blocks, uint32_t count) {
+  for(uint32_t j = 0; j < count; j++){
+    blocks[j] = allocate_block();
+    if(blocks[j] == 0){
+      while(j > 0){
+        j--;
+        release_block(blocks[j]);
+      }
+      return E_DISK_FULL;
+    }
+  }
+  return E_SUCCESS;
+}
+
+
+// appends count bytes to an uncompressed file and writes back its inode; in
+// dedup mode every block that ends up full is shared with an identical block
+// if there is one, instead of being written
+static int plain_append(block_num_t inode_num, struct block *inode, const void *buf, uint32_t count) {
+  uint32_t original_size = inode->contents.inode.file_size;
+  uint32_t after_size = original_size + count;
+  uint32_t data_block_total_ori = blocks_for(original_size);
+  uint32_t data_block_total_aft = blocks_for(after_size);
+  //the blocks preallocated by jfs_fallocate come right after the ones in use
+  uint32_t reserved_end = data_block_total_ori + inode->contents.inode.prealloc;
+  //build the new contents of the blocks from the one holding the original end of file
+  uint32_t first = original_size / BLOCK_SIZE;
+  uint32_t offset = original_size % BLOCK_SIZE;
+  uint32_t num_blocks = data_block_total_aft - first;
+  char *data = malloc(BLOCK_SIZE * (num_blocks + 1));
+  memset(data, -1, BLOCK_SIZE * (num_blocks + 1));
+  if(offset != 0){
+    read_block(inode->contents.inode.data_blocks[first], data);
+  }
+  memcpy(data + offset, buf, count);
+  //look up the full blocks, and count how many blocks have to be allocated;
+  //a block identical to an earlier one of this write is only looked up once
+  //that one is in the index, and gets a block too in case it can't be shared
+  block_num_t shared[MAX_DATA_BLOCKS];
+  bool_t later[MAX_DATA_BLOCKS];
+  uint32_t add_block = 0;
+  for(uint32_t q = 0; q < num_blocks; q++){
+    shared[q] = 0;
+    later[q] = 0;
+    //a preallocated block is filled in place rather than shared, to keep the file in one run
+    bool_t preallocated = first + q >= data_block_total_ori && first + q < reserved_end;
+    if(dedup_on && !preallocated && (first + q + 1) * BLOCK_SIZE <= after_size){
+      for(uint32_t p = 0; p < q && !later[q]; p++){
+        later[q] = shared[p] == 0 && memcmp(data + BLOCK_SIZE * p, data + BLOCK_SIZE * q, BLOCK_SIZE) == 0;
+      }
+      if(!later[q]){
+        shared[q] = dedup_lookup(data + BLOCK_SIZE * q);
+      }
+    }
+    if(shared[q] == 0 && first + q >= reserved_end){
+      add_block += 1;
+    }
+  }
+  block_num_t add_block_num[MAX_DATA_BLOCKS];
+  int ret = allocate_blocks(add_block_num, add_block);
+  if(ret != E_SUCCESS){
+    for(uint32_t q = 0; q < num_blocks; q++){
+      if(shared[q] != 0){
+        release_block(shared[q]);
+      }
+    }
+    free(data);
+    return ret;
+  }
+  //change the information in inode of file
+  block_num_t replaced = 0;
+  uint32_t next = 0;
+  for(uint32_t q = 0; q < num_blocks; q++){
+    block_num_t *slot = &inode->contents.inode.data_blocks[first + q];
+    if(shared[q] != 0){
+      if(first + q < data_block_total_ori){
+        replaced = *slot; //the old partial block became a duplicate
+      }
+      *slot = shared[q];
+    }else if(first + q >= reserved_end){
+      *slot = add_block_num[next++];
+    }
+  }
+  //write the data that is not shared, before the inode points to it; a block
+  //held back above is shared with the earlier one now, and its own block given back
+  block_num_t unused[MAX_DATA_BLOCKS];
+  uint32_t num_unused = 0;
+  for(uint32_t q = 0; q < num_blocks; q++){
+    if(shared[q] != 0){
+      continue;
+    }
+    block_num_t *slot = &inode->contents.inode.data_blocks[first + q];
+    if(later[q] && (shared[q] = dedup_lookup(data + BLOCK_SIZE * q)) != 0){
+      unused[num_unused++] = *slot;
+      *slot = shared[q];
+      continue;
+    }
+    write_block(*slot, data + BLOCK_SIZE * q);
+    if(dedup_on && (first + q + 1) * BLOCK_SIZE <= after_size){
+      dedup_insert(*slot, data + BLOCK_SIZE * q);
+    }
+  }
+  inode->contents.inode.file_size = after_size;
+  inode->contents.inode.prealloc = reserved_end > data_block_total_aft ? reserved_end - data_block_total_aft : 0;
+  write_block(inode_num, inode);
+  if(replaced != 0){
+    release_data_block(replaced);
+  }
+  for(uint32_t k = 0; k < num_unused; k++){
+    release_block(unused[k]);
+  }
+  free(data);
+  return E_SUCCESS;
+}
+
+
+// appends count bytes to a compressed file and writes back its inode; only the
+// last (partial) group and the new groups are recompressed
+static int compressed_append(block_num_t inode_num, struct block *inode, const void *buf, uint32_t count) {
+  uint32_t original_size = inode->contents.inode.file_size;
+  uint32_t after_size = original_size + count;
+  if(count == 0){
+    write_block(inode_num, inode);
+    return E_SUCCESS;
+  }
+  uint32_t g_first = original_size / COMPRESS_GROUP_SIZE;
+  uint32_t g_last = (after_size - 1) / COMPRESS_GROUP_SIZE;
+  uint32_t num_groups = g_last - g_first + 1;
+  char (*packed)[COMPRESS_GROUP_SIZE] = malloc(num_groups * COMPRESS_GROUP_SIZE);
+  uint32_t need[MAX_DATA_BLOCKS / COMPRESS_GROUP_BLOCKS];
+  uint32_t add_block = 0;
+  //compress every group that changes and work out how many blocks it needs
+  for(uint32_t g = g_first; g <= g_last; g++){
+    char plain[COMPRESS_GROUP_SIZE];
+    uint32_t len_ori = group_length(original_size, g);
+    uint32_t len_aft = group_length(after_size, g);
+    if(len_ori > 0 && group_load(inode, g, plain) != E_SUCCESS){
+      free(packed);
+      return E_UNKNOWN;
+    }
+    memcpy(plain + len_ori, (const char *) buf + (g * COMPRESS_GROUP_SIZE + len_ori - original_size), len_aft - len_ori);
+    need[g - g_first] = group_pack(plain, len_aft, packed[g - g_first]);
+    uint32_t have = group_blocks(inode, g);
+    if(need[g - g_first] > have){
+      add_block += need[g - g_first] - have;
+    }
+  }
+  block_num_t add_block_num[MAX_DATA_BLOCKS];
+  int ret = allocate_blocks(add_block_num, add_block);
+  if(ret != E_SUCCESS){
+    free(packed);
+    return ret;
+  }
+  //reuse the blocks each group already has, and give back the ones it no longer needs
+  block_num_t unused[MAX_DATA_BLOCKS];
+  uint32_t num_unused = 0;
+  uint32_t next = 0;
+  for(uint32_t g = g_first; g <= g_last; g++){
+    block_num_t *slots = &inode->contents.inode.data_blocks[g * COMPRESS_GROUP_BLOCKS];
+    for(uint32_t k = 0; k < COMPRESS_GROUP_BLOCKS; k++){
+      if(k < need[g - g_first]){
+        if(slots[k] == 0){
+          slots[k] = add_block_num[next++];
+        }
+        write_block(slots[k], packed[g - g_first] + k * BLOCK_SIZE);
+      }else if(slots[k] != 0){
+        unused[num_unused++] = slots[k];
+        slots[k] = 0;
+      }
+    }
+  }
+  inode->contents.inode.file_size = after_size;
+  write_block(inode_num, inode);
+  for(uint32_t k = 0; k < num_unused; k++){
+    release_block(unused[k]);
+  }
+  free(packed);
+  return E_SUCCESS;
+}
+
+
+// appends count bytes to a file (the caller has checked MAX_FILE_SIZE)
+static int file_append(block_num_t inode_num, struct block *inode, const void *buf, uint32_t count) {
+  if(inode->contents.inode.flags & JFS_COMPRESSED){
+    return compressed_append(inode_num, inode, buf, count);
+  }
+  return plain_append(inode_num, inode, buf, count);
+}
+
+
+// adds the full data blocks of every uncompressed file below a directory to
+// the dedup index
+static void dedup_index_dir(block_num_t dir_num) {
+  struct block dir;
+  read_block(dir_num, &dir);
+  for(int i = 0; i < dir.contents.dirnode.num_entries; i++){
+    struct block child;
+    read_block(dir.contents.dirnode.entries[i].block_num, &child);
+    if(child.is_dir == 0){
+      dedup_index_dir(dir.contents.dirnode.entries[i].block_num);
+      continue;
+    }
+    if(child.contents.inode.flags & JFS_COMPRESSED){
+      continue;
+    }
+    uint32_t full_blocks = child.contents.inode.file_size / BLOCK_SIZE;
+    for(uint32_t k = 0; k < full_blocks; k++){
+      char data[BLOCK_SIZE];
+      read_block(child.contents.inode.data_blocks[k], data);
+      dedup_insert(child.contents.inode.data_blocks[k], data);
+    }
+  }
+}
+
+
+// counts the files and directories below a directory (and the directory itself)
+static void count_dir(block_num_t dir_num, int *files, int *dirs) {
+  struct block dir;
+  read_block(dir_num, &dir);
+  *dirs += 1;
+  for(int i = 0; i < dir.contents.dirnode.num_entries; i++){
+    if(is_dir(dir.contents.dirnode.entries[i].block_num)){
+      count_dir(dir.contents.dirnode.entries[i].block_num, files, dirs);
+    }else{
+      *files += 1;
+    }
+  }
+}
+
+
+// counts the files and directories of the image if it doesn't know them
+// (it wasn't unmounted cleanly, or was written before they were kept)
+static void count_usage() {
+  struct bfs_usage usage;
+  if(!bfs_usage(&usage)){
+    int files = 0, dirs = 0;
+    count_dir(1, &files, &dirs);
+    bfs_set_usage(files, dirs);
+  }
+}
+
+
 /* jfs_mount
  *   prepares the DISK file on the _real_ file system to have file system
  *   blocks read and written to it.  The application _must_ call this function
@@ -40,6 +439,40 @@ static bool_t is_dir(block_num_t block_num) {
 int jfs_mount(const char* filename) {
   int ret = bfs_mount(filename);
   current_dir = 1;
+  sync_mode = JFS_SYNC_NONE;
+  dedup_reset();
+  dedup_on = FALSE;
+  if(ret == 0 && (bfs_features() & BFS_FEATURE_DEDUP)){
+    dedup_on = TRUE;
+    dedup_index_dir(1);
+  }
+  if(ret == 0){
+    count_usage();
+  }
+  return ret;
+}
+
+
+/* jfs_mount_shared
+ *   like jfs_mount(), but several processes can have the same DISK file
+ *   mounted at once: they share one block cache in shared memory, and each
+ *   jfs_* operation locks the directory it works in (and the bitmap while it
+ *   allocates), so operations of different processes don't clobber each
+ *   other.  Deduplication and transactions are not available on a shared
+ *   mount.
+ * filename - the name of the DISK file on the _real_ file system
+ * returns 0 on success or -1 on error (including when another process has the
+ *   file mounted with jfs_mount)
+ */
+int jfs_mount_shared(const char* filename) {
+  int ret = bfs_mount_shared(filename);
+  current_dir = 1;
+  sync_mode = JFS_SYNC_NONE;
+  dedup_reset();
+  dedup_on = FALSE;
+  if(ret == 0){
+    count_usage();
+  }
   return ret;
 }
 
@@ -50,7 +483,7 @@ int jfs_mount(const char* filename) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES, E_DISK_FULL
  */
-int jfs_mkdir(const char* directory_name) {
+static int do_mkdir(const char* directory_name) {
   //read directory_block of current directory
   void *buf = malloc(BLOCK_SIZE);
   read_block(current_dir, buf);
@@ -95,6 +528,7 @@ int jfs_mkdir(const char* directory_name) {
   (*new_dir).contents.dirnode.num_entries = 0;
   write_block(block_num_new, buf2);
   free(buf2);
+  bfs_adjust_usage(0, 1);
   return E_SUCCESS;
 }
 
@@ -108,7 +542,7 @@ int jfs_mkdir(const char* directory_name) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_NOT_DIR
  */
-int jfs_chdir(const char* directory_name) {
+static int do_chdir(const char* directory_name) {
   //check if the directory_name is NULL
   if(directory_name == NULL){
     current_dir = 1;
@@ -150,7 +584,7 @@ int jfs_chdir(const char* directory_name) {
  * returns 0 on success or one of the following error codes on failure:
  *   (this function should always succeed)
  */
-int jfs_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]) {
+static int do_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]) {
   //read directory_block of current directory
   void *buf = malloc(BLOCK_SIZE);
   read_block(current_dir, buf);
@@ -191,7 +625,7 @@ int jfs_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1])
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_NOT_DIR, E_NOT_EMPTY
  */
-int jfs_rmdir(const char* directory_name) {
+static int do_rmdir(const char* directory_name) {
   //read directory_block of current directory
   void *buf = malloc(BLOCK_SIZE);
   read_block(current_dir, buf);
@@ -202,12 +636,15 @@ int jfs_rmdir(const char* directory_name) {
     if(strcmp(directory_name, (*cur_dir).contents.dirnode.entries[i].name) == 0){
       if(is_dir((*cur_dir).contents.dirnode.entries[i].block_num)){
         block_num_t rm_dir = (*cur_dir).contents.dirnode.entries[i].block_num;        
+        //lock rm_dir too, so no process sharing the mount adds to it while it is removed
+        raw_lock_block(rm_dir);
         //read directory_block of rm_dir
         void *buf2 = malloc(BLOCK_SIZE);
         read_block(rm_dir, buf2);
         struct block *remove_dir = (struct block *) buf2;
         //check if the dir is empty
         if((*remove_dir).contents.dirnode.num_entries != 0){
+          raw_unlock_block(rm_dir);
           free(buf);
           free(buf2);
           return E_NOT_EMPTY;
@@ -222,8 +659,10 @@ int jfs_rmdir(const char* directory_name) {
         (*cur_dir).contents.dirnode.num_entries -= 1;
         write_block(current_dir, buf);
         release_block(rm_dir);
+        raw_unlock_block(rm_dir);
         free(buf);
         free(buf2);
+        bfs_adjust_usage(0, -1);
         return E_SUCCESS;
       }else{
         free(buf);
@@ -242,7 +681,7 @@ int jfs_rmdir(const char* directory_name) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES, E_DISK_FULL
  */
-int jfs_creat(const char* file_name) {
+static int do_creat(const char* file_name) {
   //read directory_block of current directory
   void *buf = malloc(BLOCK_SIZE);
   read_block(current_dir, buf);
@@ -281,12 +720,13 @@ int jfs_creat(const char* file_name) {
   free(buf);
   //Configure information for the new file(inode)
   void *buf2 = malloc(BLOCK_SIZE);
-  read_block(block_num_new, buf2);
+  memset(buf2, 0, BLOCK_SIZE);
   struct block *new_file = (struct block *) buf2;
   (*new_file).is_dir = 1;
   (*new_file).contents.inode.file_size = 0;
   write_block(block_num_new, buf2);
   free(buf2);
+  bfs_adjust_usage(1, 0);
   return E_SUCCESS;
 }
 
@@ -298,7 +738,7 @@ int jfs_creat(const char* file_name) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR
  */
-int jfs_remove(const char* file_name) {
+static int do_remove(const char* file_name) {
   //read directory_block of current directory
   void *buf = malloc(BLOCK_SIZE);
   read_block(current_dir, buf);
@@ -323,17 +763,10 @@ int jfs_remove(const char* file_name) {
         (*cur_dir).contents.dirnode.num_entries -= 1;
         write_block(current_dir, buf);
         //release inode and all of the data blocks
-        uint32_t size = remove_file->contents.inode.file_size;
-        uint32_t data_block_total = size / BLOCK_SIZE;
-        if(size % BLOCK_SIZE != 0){
-          data_block_total += 1;
-        }
-        for(uint32_t j = 0; j < data_block_total; j++){
-          release_block(remove_file->contents.inode.data_blocks[j]);
-        }
-        release_block(rm_file);
+        inode_release_blocks(remove_file, rm_file);
         free(buf);
         free(buf2);
+        bfs_adjust_usage(-1, 0);
         return E_SUCCESS;
       }else{
         free(buf);
@@ -346,6 +779,162 @@ int jfs_remove(const char* file_name) {
 }
 
 
+// returns the index of the entry with the given name in a dir block, or -1
+static int find_entry(struct block *dir, const char *name) {
+  for(int i = 0; i < dir->contents.dirnode.num_entries; i++){
+    if(strcmp(name, dir->contents.dirnode.entries[i].name) == 0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+// removes entry i from a dir block (the last entry takes its place)
+static void remove_entry(struct block *dir, int i) {
+  uint16_t *num_ent = &dir->contents.dirnode.num_entries;
+  if(i != *num_ent - 1){
+    dir->contents.dirnode.entries[i] = dir->contents.dirnode.entries[*num_ent - 1];
+  }
+  *num_ent -= 1;
+}
+
+
+// finds the directory holding the last name of a path: the names before it
+// ('/' separated, from the root directory if the path starts with '/' and
+// from the current directory otherwise) have to be directories
+static int resolve_parent(const char *path, block_num_t *dir, char name[MAX_NAME_LENGTH + 1]) {
+  *dir = current_dir;
+  if(*path == '/'){
+    *dir = 1;
+    path++;
+  }
+  while(1){
+    const char *end = strchr(path, '/');
+    size_t len = end != NULL ? (size_t) (end - path) : strlen(path);
+    if(len == 0){
+      return E_NOT_EXISTS;
+    }
+    if(len > MAX_NAME_LENGTH){
+      return E_MAX_NAME_LENGTH;
+    }
+    memcpy(name, path, len);
+    name[len] = '\0';
+    if(end == NULL){
+      return E_SUCCESS;
+    }
+    struct block d;
+    read_block(*dir, &d);
+    int i = find_entry(&d, name);
+    if(i < 0){
+      return E_NOT_EXISTS;
+    }
+    if(!is_dir(d.contents.dirnode.entries[i].block_num)){
+      return E_NOT_DIR;
+    }
+    *dir = d.contents.dirnode.entries[i].block_num;
+    path = end + 1;
+  }
+}
+
+
+// TRUE if target is the directory dir or somewhere below it
+static bool_t is_below(block_num_t dir, block_num_t target) {
+  if(dir == target){
+    return TRUE;
+  }
+  struct block d;
+  read_block(dir, &d);
+  for(int i = 0; i < d.contents.dirnode.num_entries; i++){
+    block_num_t child = d.contents.dirnode.entries[i].block_num;
+    if(is_dir(child) && is_below(child, target)){
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/* jfs_rename
+ *   gives a file or directory a new name, possibly in another directory; only
+ *   the entries in the two directories change (the data blocks and the inode
+ *   stay where they are).  If a file of the new name exists and the renamed
+ *   one is a file too, it is replaced.
+ * src - path of the file or directory to rename
+ * dst - its new path
+ * (a path is a list of names separated by '/': all but the last one name
+ *  directories, and it starts at the root directory if it starts with '/',
+ *  or at the current directory otherwise)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_NOT_DIR, E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES,
+ *   E_INVALID (a directory can't be moved below itself)
+ */
+static int do_rename(block_num_t src_dir, const char *src_name, block_num_t dst_dir, const char *dst_name) {
+  struct block s;
+  read_block(src_dir, &s);
+  int i = find_entry(&s, src_name);
+  if(i < 0){
+    return E_NOT_EXISTS;
+  }
+  block_num_t moved = s.contents.dirnode.entries[i].block_num;
+  bool_t moved_dir = is_dir(moved);
+  if(moved_dir && is_below(moved, dst_dir)){
+    return E_INVALID;
+  }
+  //with both entries in one directory, d is the same block as s
+  struct block d_buf;
+  struct block *d = &s;
+  if(dst_dir != src_dir){
+    read_block(dst_dir, &d_buf);
+    d = &d_buf;
+  }
+  int t = find_entry(d, dst_name);
+  if(t >= 0 && d->contents.dirnode.entries[t].block_num == moved){
+    return E_SUCCESS; //renamed to itself
+  }
+  block_num_t replaced = 0;
+  if(t >= 0){
+    replaced = d->contents.dirnode.entries[t].block_num;
+    if(moved_dir || is_dir(replaced)){
+      return E_EXISTS;
+    }
+  }else if(d != &s && d->contents.dirnode.num_entries == MAX_DIR_ENTRIES){
+    return E_MAX_DIR_ENTRIES;
+  }
+
+  if(d == &s){
+    //a single write of the directory
+    if(t >= 0){
+      s.contents.dirnode.entries[t].block_num = moved;
+      remove_entry(&s, i);
+    }else{
+      strcpy(s.contents.dirnode.entries[i].name, dst_name);
+    }
+    write_block(src_dir, &s);
+  }else{
+    //the old entry is removed first: if only one of the two writes makes
+    //it to the disk, the file has no name (a leaked inode) instead of two
+    //names that would each free it when removed
+    remove_entry(&s, i);
+    write_block(src_dir, &s);
+    if(t < 0){
+      t = d->contents.dirnode.num_entries++;
+      strcpy(d->contents.dirnode.entries[t].name, dst_name);
+    }
+    d->contents.dirnode.entries[t].block_num = moved;
+    write_block(dst_dir, d);
+  }
+
+  if(replaced != 0){
+    struct block inode;
+    read_block(replaced, &inode);
+    inode_release_blocks(&inode, replaced);
+    bfs_adjust_usage(-1, 0);
+  }
+  return E_SUCCESS;
+}
+
+
 /* jfs_stat
  *   returns the file or directory stats (see struct stat for details)
  * name - name of the file or directory to inspect
@@ -354,7 +943,7 @@ int jfs_remove(const char* file_name) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS
  */
-int jfs_stat(const char* name, struct stats* buf) {
+static int do_stat(const char* name, struct stats* buf) {
   //read directory_block of current directory
   void *buf1 = malloc(BLOCK_SIZE);
   read_block(current_dir, buf1);
@@ -378,11 +967,9 @@ int jfs_stat(const char* name, struct stats* buf) {
         //the block is a file
         buf->is_dir = 1;
         buf->file_size = file_or_dir->contents.inode.file_size;
-        uint32_t data_block_total = buf->file_size / BLOCK_SIZE;
-        if(buf->file_size % BLOCK_SIZE != 0){
-          data_block_total += 1;
-        }
-        buf->num_data_blocks = data_block_total;
+        buf->num_data_blocks = inode_num_blocks(file_or_dir);
+        buf->flags = file_or_dir->contents.inode.flags;
+        buf->reserved_blocks = file_or_dir->contents.inode.prealloc;
       }
       free(buf1);
       free(buf2);
@@ -404,7 +991,7 @@ int jfs_stat(const char* name, struct stats* buf) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR, E_MAX_FILE_SIZE, E_DISK_FULL
  */
-int jfs_write(const char* file_name, const void* buf, unsigned short count) {
+static int do_write(const char* file_name, const void* buf, unsigned short count) {
   //read directory_block of current directory
   void *buf1 = malloc(BLOCK_SIZE);
   read_block(current_dir, buf1);
@@ -423,82 +1010,29 @@ int jfs_write(const char* file_name, const void* buf, unsigned short count) {
         read_block(file_num, buf2);
         struct block *write_to_file = (struct block *) buf2;
         //check if the size after writing is too large
-        uint32_t original_size = write_to_file->contents.inode.file_size;
-        uint32_t after_size = original_size + count;
+        uint32_t after_size = write_to_file->contents.inode.file_size + count;
         if(after_size > MAX_FILE_SIZE){
           free(buf1);
           free(buf2);
           return E_MAX_FILE_SIZE;
         }
-        //calculate the number of blocks need to be add
-        uint32_t data_block_total_ori = original_size / BLOCK_SIZE;
-        if(original_size != 0 && original_size % BLOCK_SIZE != 0){
-          data_block_total_ori += 1;
-        }
-        uint32_t data_block_total_aft = after_size / BLOCK_SIZE;
-        if(after_size != 0 && after_size % BLOCK_SIZE != 0){
-          data_block_total_aft += 1;
-        }
-        int32_t add_block = data_block_total_aft - data_block_total_ori;
-        //check if the disk is full after add new blocks
-        block_num_t add_block_num[add_block];
-        int32_t j = 0;
-        while(j < add_block){
-          add_block_num[j] = allocate_block();
-          if(add_block_num[j] == 0){
-            //disk is full, release all blocks have been allocated
-            j -= 1;
-            while(j >= 0){
-              release_block(add_block_num[j]);
-              j--;
-            }
-            free(buf1);
-            free(buf2);
-            return E_DISK_FULL;
-          }
-          j += 1;
-        }
-        //change the information in inode of file
-        write_to_file->contents.inode.file_size = after_size;
-        for(int32_t k = 0; k < add_block; k++){
-          write_to_file->contents.inode.data_blocks[k + data_block_total_ori] = add_block_num[k];
-        }
-        write_block(file_num, buf2);
-        //append data to block(get the last block of file to buf3, append buf to buf3, write it all, start at the original last block)
-        uint32_t offset = original_size % BLOCK_SIZE;
-        void *buf4;
-        if(original_size != 0){
-          //the last node has space to append
-          buf4 = malloc(BLOCK_SIZE * (add_block + 1));
-          memset(buf4, -1, BLOCK_SIZE * (add_block + 1));
-          void *buf3 = malloc(BLOCK_SIZE);
-          read_block(write_to_file->contents.inode.data_blocks[data_block_total_ori - 1], buf3);
-          memcpy(buf4, buf3, BLOCK_SIZE);
-          free(buf3);
-          if(offset == 0){
-            memcpy(buf4 + BLOCK_SIZE, buf, count);
-          }else{
-            memcpy(buf4 + offset, buf, count);
-          } 
-        }else{
-          buf4 = malloc(BLOCK_SIZE * add_block);
-          memset(buf4, -1, BLOCK_SIZE * add_block);
-          memcpy(buf4, buf, count);
-        }
-        
-        
-        uint32_t start = 0;
-        if(data_block_total_ori > 0){
-          start = data_block_total_ori - 1;
-        }
-        for(uint32_t q = 0; start < data_block_total_aft; q++){
-          write_block(write_to_file->contents.inode.data_blocks[start], buf4 + BLOCK_SIZE * q);
-          start += 1;
+        //without dedup or compression a write needs exactly one new block for
+        //every block the file grows by (less the preallocated ones), so one
+        //that can't fit is refused before anything is allocated
+        struct bfs_usage usage;
+        bfs_usage(&usage);
+        uint32_t new_blocks = blocks_for(after_size) - blocks_for(write_to_file->contents.inode.file_size);
+        uint32_t prealloc = write_to_file->contents.inode.prealloc;
+        new_blocks = new_blocks > prealloc ? new_blocks - prealloc : 0;
+        if(!dedup_on && !(write_to_file->contents.inode.flags & JFS_COMPRESSED) && new_blocks > usage.free_blocks){
+          free(buf1);
+          free(buf2);
+          return E_DISK_FULL;
         }
+        int ret = file_append(file_num, write_to_file, buf, count);
         free(buf1);
         free(buf2);
-        free(buf4);
-        return E_SUCCESS;
+        return ret;
       }
     }
   }
@@ -520,7 +1054,7 @@ int jfs_write(const char* file_name, const void* buf, unsigned short count) {
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR
  */
-int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
+static int do_read(const char* file_name, void* buf, unsigned short* ptr_count) {
   //read directory_block of current directory
   void *buf1 = malloc(BLOCK_SIZE);
   read_block(current_dir, buf1);
@@ -541,25 +1075,70 @@ int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
         if(size < *ptr_count){
           *ptr_count = size;
         }
-        int32_t read_size = (int32_t) *ptr_count;
-        uint32_t i = 0;
-        //read data into buf3 then copy to buf
-        uint32_t data_block_total = read_size / BLOCK_SIZE;
-        if(read_size != 0 && read_size % BLOCK_SIZE != 0){
-          data_block_total += 1;
-        }
-        void *buf3 = malloc(BLOCK_SIZE * (data_block_total + 1));
-        while(read_size > 0){
-          read_block(read_file->contents.inode.data_blocks[i], buf3 + i * BLOCK_SIZE);
-          i += 1;
-          read_size -= BLOCK_SIZE;
-        }
-        memcpy(buf, buf3, *ptr_count);
+        int ret = file_read_data(read_file, buf, *ptr_count);
         free(buf1);
         free(buf2);
-        free(buf3);
+        return ret;
+      }
+    }
+  }
+  free(buf1);
+  return E_NOT_EXISTS;
+}
+
+
+/* jfs_compress
+ *   turns compression of the specified file on or off; the existing data of
+ *   the file is rewritten in the new format, and later jfs_write() and
+ *   jfs_read() calls compress and decompress it transparently (blocks
+ *   preallocated for the file are released)
+ * file_name - name of the file
+ * enable - nonzero to store the file compressed, 0 to store it uncompressed
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_IS_DIR, E_DISK_FULL
+ */
+static int do_compress(const char* file_name, int enable) {
+  //read directory_block of current directory
+  void *buf1 = malloc(BLOCK_SIZE);
+  read_block(current_dir, buf1);
+  struct block *cur_dir = (struct block *) buf1;
+  uint16_t *num_ent = &((*cur_dir).contents.dirnode.num_entries);
+  for(int i = 0; i < *num_ent; i++){
+    if(strcmp(file_name, (*cur_dir).contents.dirnode.entries[i].name) == 0){
+      block_num_t file_num = (*cur_dir).contents.dirnode.entries[i].block_num;
+      free(buf1);
+      if(is_dir(file_num)){
+        return E_IS_DIR;
+      }
+      struct block old_inode;
+      read_block(file_num, &old_inode);
+      uint8_t flags = old_inode.contents.inode.flags;
+      if(enable){
+        flags |= JFS_COMPRESSED;
+      }else{
+        flags &= ~JFS_COMPRESSED;
+      }
+      if(flags == old_inode.contents.inode.flags){
         return E_SUCCESS;
       }
+      //write the data out again into a fresh inode; the old blocks are only
+      //released once the new copy is complete, so a full disk loses nothing
+      uint32_t size = old_inode.contents.inode.file_size;
+      char data[MAX_FILE_SIZE];
+      int ret = file_read_data(&old_inode, data, size);
+      if(ret != E_SUCCESS){
+        return ret;
+      }
+      struct block new_inode;
+      memset(&new_inode, 0, sizeof(new_inode));
+      new_inode.is_dir = 1;
+      new_inode.contents.inode.flags = flags;
+      ret = file_append(file_num, &new_inode, data, size);
+      if(ret != E_SUCCESS){
+        return ret;
+      }
+      inode_release_blocks(&old_inode, 0);
+      return E_SUCCESS;
     }
   }
   free(buf1);
@@ -567,6 +1146,546 @@ int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
 }
 
 
+/* jfs_fallocate
+ *   reserves data blocks for a file to grow into, so that later jfs_write()
+ *   calls fill them without going to the allocator and the file isn't
+ *   interleaved with the blocks of other files; the blocks are taken as one
+ *   run if there is one long enough (otherwise wherever they are free).  They
+ *   don't count in the file size, and are released with the file.
+ * file_name - name of the file
+ * size - the file size to make room for (nothing happens if the file
+ *   already has room for it)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_IS_DIR, E_MAX_FILE_SIZE, E_DISK_FULL, E_INVALID (the
+ *   file is compressed, so how many blocks it will need isn't known)
+ */
+static int do_fallocate(const char* file_name, unsigned short size) {
+  struct block dir;
+  read_block(current_dir, &dir);
+  int i = find_entry(&dir, file_name);
+  if(i < 0){
+    return E_NOT_EXISTS;
+  }
+  block_num_t inode_num = dir.contents.dirnode.entries[i].block_num;
+  if(is_dir(inode_num)){
+    return E_IS_DIR;
+  }
+  if(size > MAX_FILE_SIZE){
+    return E_MAX_FILE_SIZE;
+  }
+  struct block inode;
+  read_block(inode_num, &inode);
+  if(inode.contents.inode.flags & JFS_COMPRESSED){
+    return E_INVALID;
+  }
+  uint32_t have = blocks_for(inode.contents.inode.file_size) + inode.contents.inode.prealloc;
+  uint32_t want = blocks_for(size);
+  if(want <= have){
+    return E_SUCCESS;
+  }
+  uint32_t count = want - have;
+  block_num_t *slots = &inode.contents.inode.data_blocks[have];
+  block_num_t first = allocate_run(count);
+  if(first != 0){
+    for(uint32_t k = 0; k < count; k++){
+      slots[k] = first + k;
+    }
+  }else if(allocate_blocks(slots, count) != E_SUCCESS){
+    return E_DISK_FULL;
+  }
+  inode.contents.inode.prealloc += count;
+  write_block(inode_num, &inode);
+  return E_SUCCESS;
+}
+
+
+/* jfs_dedup
+ *   turns deduplication of data blocks on or off for the image; while it is on,
+ *   every full data block written by jfs_write() that is identical to a block
+ *   already on the disk shares that block instead of allocating a new one
+ *   (compressed files are not deduplicated)
+ * enable - nonzero to turn deduplication on, 0 to turn it off (blocks that are
+ *   already shared stay shared)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_DISK_FULL (no room for the reference count table, or an older image
+ *   uses the block of the extended superblock for data), E_UNKNOWN (the mount
+ *   is shared)
+ */
+static int do_dedup(int enable) {
+  //the index is private to each process, so it can't be trusted on a shared mount
+  if(raw_is_shared()){
+    return E_UNKNOWN;
+  }
+  int features = bfs_features();
+  if(enable){
+    features |= BFS_FEATURE_DEDUP;
+  }else{
+    features &= ~BFS_FEATURE_DEDUP;
+  }
+  if(bfs_set_features(features) < 0){
+    return enable ? E_DISK_FULL : E_UNKNOWN;
+  }
+  if(enable && !dedup_on){
+    dedup_reset();
+    dedup_index_dir(1);
+  }
+  dedup_on = enable ? TRUE : FALSE;
+  return E_SUCCESS;
+}
+
+
+int jfs_dedup(int enable) {
+  uint64_t traced = trace_begin();
+  int ret = do_dedup(enable);
+  trace_end(TRACE_DEDUP, traced, ret, enable != 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* jfs_dedup_stats
+ *   reports how well deduplication is working (see struct dedup_stats); the
+ *   dedup ratio is references / indexed
+ * buf - pointer to a struct dedup_stats (already allocated by the caller)
+ * returns 0 on success
+ */
+int jfs_dedup_stats(struct dedup_stats* buf) {
+  dedup_get_stats(buf);
+  return E_SUCCESS;
+}
+
+
+/* jfs_checksums
+ *   turns block checksums on or off for the image; while they are on, every
+ *   block has a CRC-32C in a table of CHECKSUM_BLOCKS blocks, which is
+ *   updated whenever the block is written and checked whenever it is read
+ *   from the disk (a block that fails the check can't be read)
+ * enable - nonzero to turn checksums on, 0 to turn them off (and free the table)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_DISK_FULL (no run of CHECKSUM_BLOCKS free blocks, or an older image
+ *   uses the block of the extended superblock for data)
+ */
+int jfs_checksums(int enable) {
+  uint64_t traced = trace_begin();
+  int features = bfs_features();
+  if(enable){
+    features |= BFS_FEATURE_CHECKSUMS;
+  }else{
+    features &= ~BFS_FEATURE_CHECKSUMS;
+  }
+  int ret = E_SUCCESS;
+  if(bfs_set_features(features) < 0){
+    ret = enable ? E_DISK_FULL : E_UNKNOWN;
+  }
+  trace_end(TRACE_CHECKSUMS, traced, ret, enable != 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+// in JFS_SYNC_OP mode, a call that changed the image doesn't return before
+// its writes are on stable storage (a call that failed may have written too)
+static int sync_op(int ret) {
+  if(sync_mode == JFS_SYNC_OP && raw_flush() < 0 && ret == E_SUCCESS){
+    return E_UNKNOWN;
+  }
+  return ret;
+}
+
+
+/* jfs_statfs
+ *   reports the size of the image, how much of it is free and how many files
+ *   and directories it holds; the numbers are kept up to date as the image
+ *   changes, so this doesn't scan the disk
+ * buf - pointer to a struct jfs_statfs (already allocated by the caller)
+ * returns 0 on success
+ */
+int jfs_statfs(struct jfs_statfs* buf) {
+  struct bfs_usage usage;
+  if(!bfs_usage(&usage)){
+    //only a shared mount of an image without an extended superblock gets here
+    int files = 0, dirs = 0;
+    count_dir(1, &files, &dirs);
+    usage.num_files = files;
+    usage.num_dirs = dirs;
+  }
+  buf->block_size = BLOCK_SIZE;
+  buf->total_blocks = NUM_BLOCKS;
+  buf->free_blocks = usage.free_blocks;
+  buf->num_files = usage.num_files;
+  buf->num_dirs = usage.num_dirs;
+  return E_SUCCESS;
+}
+
+
+/* jfs_durability
+ *   picks when written blocks are forced to stable storage (JFS_SYNC_NONE
+ *   after mounting); the writes of a whole interval, or of a whole operation,
+ *   are covered by a single fdatasync
+ * mode - JFS_SYNC_NONE, JFS_SYNC_OP or JFS_SYNC_PERIODIC
+ * interval_ms - the flush interval for JFS_SYNC_PERIODIC (ignored otherwise)
+ * returns 0 on success or E_UNKNOWN on failure (bad arguments, or the
+ *   flusher thread could not be started)
+ */
+int jfs_durability(int mode, int interval_ms) {
+  uint64_t traced = trace_begin();
+  int ret = E_UNKNOWN;
+  //whatever the old mode left unsynced is synced now
+  if(mode >= JFS_SYNC_NONE && mode <= JFS_SYNC_PERIODIC && (mode != JFS_SYNC_PERIODIC || interval_ms > 0)
+     && raw_flush_interval(mode == JFS_SYNC_PERIODIC ? interval_ms : 0) == 0 && raw_flush() == 0){
+    sync_mode = mode;
+    ret = E_SUCCESS;
+  }
+  uint32_t interval = interval_ms;
+  trace_end(TRACE_DURABILITY, traced, ret, mode, 0, NULL, NULL, &interval, sizeof(interval));
+  return ret;
+}
+
+
+/* jfs_defer_release
+ *   turns deferred releasing of blocks on or off; while it is on, jfs_remove()
+ *   doesn't touch the bitmap at all, and the blocks of all the files removed
+ *   are given back in one bitmap update by jfs_sync(), jfs_unmount(), turning
+ *   it off again, or a write that finds no other free blocks (blocks still
+ *   waiting are lost if the program dies before then)
+ * enable - nonzero to defer releases, 0 to release blocks straight away
+ * returns 0 on success or E_UNKNOWN on failure (the mount is shared)
+ */
+int jfs_defer_release(int enable) {
+  uint64_t traced = trace_begin();
+  int ret = bfs_defer_release(enable) == 0 ? E_SUCCESS : E_UNKNOWN;
+  trace_end(TRACE_DEFER, traced, ret, enable != 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* jfs_sync
+ *   gives back the blocks whose release was deferred and forces everything
+ *   written so far to stable storage (in any mode; the blocks of an open
+ *   transaction are only written by jfs_commit)
+ * returns 0 on success or E_UNKNOWN on failure
+ */
+int jfs_sync() {
+  uint64_t traced = trace_begin();
+  int ret = (bfs_reclaim() == 0 && raw_flush() == 0) ? E_SUCCESS : E_UNKNOWN;
+  trace_end(TRACE_SYNC, traced, ret, 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* jfs_getcwd
+ *   returns a handle for the current directory (the number of its dir block),
+ *   which can be passed to jfs_setcwd() later to make it current again;
+ *   this lets a server keep a separate current directory for every client
+ */
+block_num_t jfs_getcwd() {
+  return current_dir;
+}
+
+
+/* jfs_setcwd
+ *   makes the directory with the given handle (from jfs_getcwd()) the
+ *   current directory
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS (the directory has been removed; the current directory is
+ *   then the root directory)
+ */
+int jfs_setcwd(block_num_t dir) {
+  uint64_t traced = trace_begin();
+  int ret = E_SUCCESS;
+  current_dir = dir;
+  if(dir == 0 || dir >= NUM_BLOCKS || block_refs(dir) == 0 || !is_dir(dir)){
+    current_dir = 1;
+    ret = E_NOT_EXISTS;
+  }
+  trace_end(TRACE_SETCWD, traced, ret, 0, dir, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* jfs_begin
+ *   starts a transaction: the blocks written by the following jfs_* calls are
+ *   kept in memory and only written to the DISK file by jfs_commit(), so
+ *   metadata that many calls update (the bitmap, directories) is written once
+ * returns 0 on success or E_UNKNOWN if a transaction is already open
+ */
+int jfs_begin() {
+  uint64_t traced = trace_begin();
+  int ret = raw_begin() == 0 ? E_SUCCESS : E_UNKNOWN;
+  trace_end(TRACE_BEGIN, traced, ret, 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* jfs_commit
+ *   ends the transaction started by jfs_begin(), writing all of the blocks it
+ *   changed to the DISK file
+ * returns 0 on success or E_UNKNOWN if no transaction is open or the blocks
+ *   could not be written
+ */
+int jfs_commit() {
+  uint64_t traced = trace_begin();
+  int ret = raw_commit() < 0 ? E_UNKNOWN : sync_op(E_SUCCESS);
+  trace_end(TRACE_COMMIT, traced, ret, 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+/* The jfs_* entry points below count and time every call (see fs_stats.h),
+ * hold the lock of the current directory while they run (for shared mounts)
+ * and otherwise just run the do_* functions above, which have the full
+ * descriptions.
+ */
+
+// locks the current directory for the length of one operation; returns
+// E_NOT_EXISTS if another process sharing the mount has removed it
+static int lock_current_dir(block_num_t *locked) {
+  *locked = current_dir;
+  raw_lock_block(*locked);
+  if(raw_is_shared() && (block_refs(*locked) == 0 || !is_dir(*locked))){
+    return E_NOT_EXISTS;
+  }
+  return E_SUCCESS;
+}
+
+
+int jfs_mkdir(const char* directory_name) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_mkdir(directory_name);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_MKDIR, start, ret);
+  trace_end(OP_MKDIR, traced, ret, 0, 0, directory_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_chdir(const char* directory_name) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS || directory_name == NULL){
+    ret = do_chdir(directory_name);
+  }
+  raw_unlock_block(dir);
+  stats_op_end(OP_CHDIR, start, ret);
+  trace_end(OP_CHDIR, traced, ret, 0, 0, directory_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_ls(directories, files);
+  }
+  raw_unlock_block(dir);
+  stats_op_end(OP_LS, start, ret);
+  trace_end(OP_LS, traced, ret, 0, 0, NULL, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_rmdir(const char* directory_name) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_rmdir(directory_name);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_RMDIR, start, ret);
+  trace_end(OP_RMDIR, traced, ret, 0, 0, directory_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_creat(const char* file_name) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_creat(file_name);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_CREAT, start, ret);
+  trace_end(OP_CREAT, traced, ret, 0, 0, file_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_remove(const char* file_name) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_remove(file_name);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_REMOVE, start, ret);
+  trace_end(OP_REMOVE, traced, ret, 0, 0, file_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_stat(const char* name, struct stats* buf) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_stat(name, buf);
+  }
+  raw_unlock_block(dir);
+  stats_op_end(OP_STAT, start, ret);
+  trace_end(OP_STAT, traced, ret, 0, 0, name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_write(const char* file_name, const void* buf, unsigned short count) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_write(file_name, buf, count);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_WRITE, start, ret);
+  trace_end(OP_WRITE, traced, ret, 0, count, file_name, NULL, buf, count);
+  if(ret == E_SUCCESS){
+    STATS_ADD(bytes_written, count);
+  }
+  return ret;
+}
+
+
+int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  unsigned short asked = *ptr_count;
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_read(file_name, buf, ptr_count);
+  }
+  raw_unlock_block(dir);
+  stats_op_end(OP_READ, start, ret);
+  trace_end(OP_READ, traced, ret, 0, asked, file_name, NULL, NULL, 0);
+  if(ret == E_SUCCESS){
+    STATS_ADD(bytes_read, *ptr_count);
+  }
+  return ret;
+}
+
+
+int jfs_compress(const char* file_name, int enable) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_compress(file_name, enable);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_COMPRESS, start, ret);
+  trace_end(OP_COMPRESS, traced, ret, enable != 0, 0, file_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+int jfs_fallocate(const char* file_name, unsigned short size) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t dir;
+  int ret = lock_current_dir(&dir);
+  if(ret == E_SUCCESS){
+    ret = do_fallocate(file_name, size);
+  }
+  raw_unlock_block(dir);
+  ret = sync_op(ret);
+  stats_op_end(OP_FALLOCATE, start, ret);
+  trace_end(OP_FALLOCATE, traced, ret, 0, size, file_name, NULL, NULL, 0);
+  return ret;
+}
+
+
+// whether b has to be locked before a: parent before child if one is below
+// the other (like jfs_rmdir does), and the lower block number first otherwise
+static int lock_b_first(block_num_t a, block_num_t b) {
+  return is_below(b, a) || (b < a && !is_below(a, b));
+}
+
+
+// locks the two directories of a rename in the order of lock_b_first (the
+// caller holds raw_lock_rename if they differ, so the order can't change);
+// returns E_NOT_EXISTS if another process sharing the mount has removed one of them
+static int lock_rename_dirs(block_num_t a, block_num_t b) {
+  if(a != b && raw_is_shared() && lock_b_first(a, b)){
+    block_num_t tmp = a;
+    a = b;
+    b = tmp;
+  }
+  raw_lock_block(a);
+  if(b != a){
+    raw_lock_block(b);
+  }
+  if(raw_is_shared() && (block_refs(a) == 0 || !is_dir(a) || block_refs(b) == 0 || !is_dir(b))){
+    return E_NOT_EXISTS;
+  }
+  return E_SUCCESS;
+}
+
+
+int jfs_rename(const char* src, const char* dst) {
+  uint64_t start = stats_op_begin();
+  uint64_t traced = trace_begin();
+  block_num_t src_dir, dst_dir;
+  char src_name[MAX_NAME_LENGTH + 1], dst_name[MAX_NAME_LENGTH + 1];
+  int ret = resolve_parent(src, &src_dir, src_name);
+  if(ret == E_SUCCESS){
+    ret = resolve_parent(dst, &dst_dir, dst_name);
+  }
+  if(ret == E_SUCCESS){
+    //a move between directories locks only their parents, so two of them
+    //could each pass the is_below check of do_rename and put two directories
+    //inside each other; such moves are done one at a time
+    if(dst_dir != src_dir){
+      raw_lock_rename();
+    }
+    ret = lock_rename_dirs(src_dir, dst_dir);
+    if(ret == E_SUCCESS){
+      ret = do_rename(src_dir, src_name, dst_dir, dst_name);
+    }
+    raw_unlock_block(src_dir);
+    if(dst_dir != src_dir){
+      raw_unlock_block(dst_dir);
+      raw_unlock_rename();
+    }
+  }
+  ret = sync_op(ret);
+  stats_op_end(OP_RENAME, start, ret);
+  trace_end(OP_RENAME, traced, ret, 0, 0, src, dst, NULL, 0);
+  return ret;
+}
+
+
 /* jfs_unmount
  *   makes the file system no longer accessible (unless it is mounted again).
  *   This should be called exactly once after all other jfs_* operations are
@@ -578,6 +1697,10 @@ int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
  *   errors in the underlying disk syscalls.
  */
 int jfs_unmount() {
+  //what the last interval (or a failed op) wrote still has to be synced
+  if(sync_mode != JFS_SYNC_NONE){
+    raw_flush();
+  }
   int ret = bfs_unmount();
   return ret;
 }
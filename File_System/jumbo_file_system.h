@@ -2,6 +2,7 @@
 #define _JUMBO_FILE_SYSTEM_H_
 
 #include "basic_file_system.h"
+#include "dedup.h"
 
 
 // maximum number of characters in a file or directory name (not counting '\0')
@@ -24,16 +25,38 @@ struct stats {
   block_num_t block_num;          // of the dir block, or the inode (for regular files)
   uint16_t num_data_blocks;       // not counting the inode (ignored if is_dir is 0)
   uint32_t file_size;             // in bytes (ignored if is_dir is 0)
+  uint16_t flags;                 // JFS_* file flags (ignored if is_dir is 0)
+  uint16_t reserved_blocks;       // data blocks preallocated by jfs_fallocate (ignored if is_dir is 0)
 };
 
 
+// Struct returned by jfs_statfs()
+struct jfs_statfs {
+  uint32_t block_size;   // in bytes
+  uint32_t total_blocks; // including the superblock and the other metadata blocks
+  uint32_t free_blocks;
+  uint32_t num_files;    // regular files
+  uint32_t num_dirs;     // directories, including the root directory
+};
+
+
+// Flags stored in the inode of a regular file
+//   JFS_COMPRESSED: the data is split into groups of COMPRESS_GROUP_BLOCKS blocks
+//   and group g is stored in data_blocks[g * COMPRESS_GROUP_BLOCKS] onwards; a
+//   group that takes fewer blocks than its uncompressed size starts with a
+//   2-byte compressed length, and the data_blocks it doesn't use are 0
+#define JFS_COMPRESSED 0x1
+
+
 // This is the data stored in an inode or directory block (dirnode)
 struct block {
   uint32_t is_dir; // 0 if it is a directory, 1 if it is a regular file
 
   union {
     struct {
-      uint32_t file_size; // in bytes
+      uint16_t file_size; // in bytes
+      uint8_t flags;      // JFS_* file flags
+      uint8_t prealloc;   // data blocks reserved after the ones in use (see jfs_fallocate)
       block_num_t data_blocks[MAX_DATA_BLOCKS];
     } inode;
 
@@ -50,6 +73,7 @@ struct block {
 
 // Function comments for all of these are in jumbo_file_system.c
 int jfs_mount (const char* filename);
+int jfs_mount_shared (const char* filename);
 
 int jfs_mkdir (const char* directory_name);
 int jfs_chdir (const char* directory_name);
@@ -61,6 +85,32 @@ int jfs_remove (const char* file_name);
 int jfs_stat   (const char* name, struct stats* buf);
 int jfs_write  (const char* file_name, const void* buf, unsigned short count);
 int jfs_read   (const char* file_name, void* buf, unsigned short* ptr_count);
+int jfs_compress (const char* file_name, int enable);
+int jfs_rename (const char* src, const char* dst);
+int jfs_fallocate (const char* file_name, unsigned short size);
+
+int jfs_dedup       (int enable);
+int jfs_dedup_stats (struct dedup_stats* buf);
+
+int jfs_checksums (int enable);
+
+int jfs_statfs (struct jfs_statfs* buf);
+
+// durability modes (see jfs_durability)
+#define JFS_SYNC_NONE     0 // writes reach stable storage whenever the OS gets to them
+#define JFS_SYNC_OP       1 // every call that changes the image is on stable storage when it returns
+#define JFS_SYNC_PERIODIC 2 // a background thread flushes everything written every interval_ms
+
+int jfs_durability (int mode, int interval_ms);
+int jfs_sync       ();
+
+int jfs_defer_release (int enable);
+
+block_num_t jfs_getcwd ();
+int         jfs_setcwd (block_num_t dir);
+
+int jfs_begin  ();
+int jfs_commit ();
 
 int jfs_unmount();
 
@@ -77,5 +127,6 @@ int jfs_unmount();
 #define E_MAX_DIR_ENTRIES -8 // the operation would cause the maximum number of entries in a directory to be exceeded
 #define E_MAX_FILE_SIZE -9   // the operation would cause the maximum file size to be exceeded
 #define E_DISK_FULL -10      // the disk is full (or the operation would require more capacity than remains on the disk)
+#define E_INVALID -11        // the operation makes no sense (moving a directory below itself, preallocating a compressed file)
 
 #endif // _JUMBO_FILE_SYSTEM_H_
@@ -1,74 +1,596 @@
 #include "raw_disk.h"
+#include "disk_backend.h"
+#include "fs_stats.h"
+#include "crc32c.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 static const char* disk_filename = NULL;
-static int disk_fd = -1;
+static struct disk_dev dev;
+static int mounted = 0;
 
+// blocks held in memory while a transaction is open (see raw_begin)
+static char* tx_blocks = NULL;
+static unsigned char tx_valid[NUM_BLOCKS / 8];
+static unsigned char tx_dirty[NUM_BLOCKS / 8];
 
-int raw_mount(const char* filename) {
-  // open file; creat if it doesn't exist already
-  disk_fd = open(filename, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
-  if (disk_fd < 0) {
+#define BIT_TEST(bits, n) ((bits)[(n) / 8] & (1 << ((n) % 8)))
+#define BIT_SET(bits, n) ((bits)[(n) / 8] |= 1 << ((n) % 8))
+
+// Advisory locks on the image file: a mount holds MOUNT_LOCK_BYTE (shared
+// for a shared mount, exclusive otherwise), and shared mounts hold
+// SETUP_LOCK_BYTE while they create, attach to or remove the shared cache.
+#define MOUNT_LOCK_BYTE 0
+#define SETUP_LOCK_BYTE 1
+
+// The shared cache of a shared mount.  It lives in a POSIX shared memory
+// object named after the image, and is created by the first process that
+// mounts the image and removed by the last one.
+struct shared_cache {
+  pthread_mutex_t block_locks[NUM_BLOCKS]; // held while a block is copied in or out
+  pthread_mutex_t op_locks[NUM_BLOCKS];    // raw_lock_block (held across a whole operation)
+  pthread_mutex_t rename_lock;             // raw_lock_rename
+  unsigned char valid[NUM_BLOCKS];         // 1 if blocks[n] holds the contents of block n
+  char blocks[NUM_BLOCKS][BLOCK_SIZE];
+};
+
+static struct shared_cache* shared = NULL;
+static char shared_name[64];
+
+// The checksum table (see raw_checksums) holds the CRC-32C of every block,
+// CHECKSUM_ENTRIES to a block.  A private mount keeps a copy in crcs; a
+// shared one reads and updates the table blocks through the shared cache.
+#define CHECKSUM_ENTRIES (BLOCK_SIZE / sizeof(uint32_t))
+
+static block_num_t crc_first = 0; // first block of the table, 0 if checksums are off
+static uint32_t crcs[NUM_BLOCKS];
+
+// Writes that reached the backend since the last raw_flush.  While the
+// background flusher runs, io_lock keeps it and this thread from using the
+// backend at the same time.
+static volatile int dirty = 0;
+static int flusher_running = 0;
+static volatile int flusher_stop = 0;
+static pthread_t flusher;
+static int flush_interval_ms;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+
+static void io_begin() {
+  if (flusher_running) {
+    pthread_mutex_lock(&io_lock);
+  }
+}
+
+static void io_end() {
+  if (flusher_running) {
+    pthread_mutex_unlock(&io_lock);
+  }
+}
+
+static int fetch_block(block_num_t block_num, void* buf);
+static int store_block(block_num_t block_num, void* buf);
+
+
+// takes (type F_RDLCK or F_WRLCK) or drops (F_UNLCK) an advisory lock on one byte of the image
+static int lock_byte(int byte, short type, int wait) {
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = byte;
+  fl.l_len = 1;
+  return fcntl(dev.fd, wait ? F_SETLKW : F_SETLK, &fl);
+}
+
+
+// locks a process-shared mutex, recovering it if its owner died
+static void lock_shared_mutex(pthread_mutex_t* mutex) {
+  if (pthread_mutex_lock(mutex) == EOWNERDEAD) {
+    pthread_mutex_consistent(mutex);
+  }
+}
+
+
+static int init_mutex(pthread_mutex_t* mutex, int type) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutexattr_settype(&attr, type);
+  int ret = pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return ret;
+}
+
+
+// creates (if first) or attaches to the shared cache; called with SETUP_LOCK_BYTE held
+static int attach_shared_cache(int first) {
+  struct stat st;
+  if (fstat(dev.fd, &st) < 0) {
     return -1;
   }
+  snprintf(shared_name, sizeof(shared_name), "/jfs-%lx-%lx",
+           (unsigned long) st.st_dev, (unsigned long) st.st_ino);
 
-  // check the file size
-  off_t file_size = lseek(disk_fd, 0, SEEK_END);
-  if (file_size < 0) {
-    close(disk_fd);
-    disk_fd = -1;
+  // the first process starts from a new, empty cache (a leftover one may be stale)
+  if (first) {
+    shm_unlink(shared_name);
+  }
+  int fd = shm_open(shared_name, O_RDWR | (first ? O_CREAT | O_EXCL : 0), S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return -1;
+  }
+  if (first && ftruncate(fd, sizeof(struct shared_cache)) < 0) {
+    close(fd);
+    shm_unlink(shared_name);
     return -1;
+  }
+  shared = mmap(NULL, sizeof(struct shared_cache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shared == MAP_FAILED) {
+    shared = NULL;
+    return -1;
+  }
+  if (first) {
+    // ftruncate zero-filled the cache, so nothing is marked valid yet
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+      init_mutex(&shared->block_locks[i], PTHREAD_MUTEX_NORMAL);
+      init_mutex(&shared->op_locks[i], PTHREAD_MUTEX_RECURSIVE);
+    }
+    init_mutex(&shared->rename_lock, PTHREAD_MUTEX_NORMAL);
+  }
+  return 0;
+}
+
+
+static int open_disk(const char* filename, int share) {
+  if (mounted || backend_mount(&dev, filename, NUM_BLOCKS * BLOCK_SIZE) < 0) {
+    return -1;
+  }
+  mounted = 1;
 
-  } else if (file_size < NUM_BLOCKS * BLOCK_SIZE) {
-    // if the file size is less than it should be, we need to extend it
-    long to_write = NUM_BLOCKS * BLOCK_SIZE - file_size;
-    char* buffer = (char*) malloc(to_write * sizeof(char));
-    // make sure the new allocation writes 0's to the disk
-    for (int i = 0; i < to_write; i++) {
-      buffer[i] = 0;
+  // a private mount needs the image to itself; a shared mount first works out
+  // whether any other process has it mounted (shared) already (images that
+  // aren't files, like ram:, can't be mounted by another process at all)
+  int first = 1;
+  if (dev.fd < 0) {
+    if (share) {
+      goto fail;
+    }
+  } else if (!share) {
+    if (lock_byte(MOUNT_LOCK_BYTE, F_WRLCK, 0) < 0) {
+      goto fail;
     }
+  } else {
+    if (lock_byte(SETUP_LOCK_BYTE, F_WRLCK, 1) < 0) {
+      goto fail;
+    }
+    if (lock_byte(MOUNT_LOCK_BYTE, F_WRLCK, 0) < 0) {
+      first = 0;
+      if (lock_byte(MOUNT_LOCK_BYTE, F_RDLCK, 0) < 0) {
+        goto fail; // mounted privately by another process
+      }
+    }
+  }
 
-    // commit the file extension to disk
-    if (write(disk_fd, buffer, to_write) < to_write) {
-      close(disk_fd);
-      disk_fd = -1;
-      free(buffer);
-      return -1;
+  if (share) {
+    // other shared mounts may join once the cache exists; the mount lock is
+    // turned into a shared one (atomically) so they can take it too
+    if (attach_shared_cache(first) < 0 || lock_byte(MOUNT_LOCK_BYTE, F_RDLCK, 0) < 0) {
+      goto fail;
     }
-    free(buffer);
+    lock_byte(SETUP_LOCK_BYTE, F_UNLCK, 0);
   }
 
   disk_filename = filename;
   return 0;
+
+fail:
+  dev.ops->unmount(&dev); // closing the file drops any locks this process took
+  mounted = 0;
+  return -1;
 }
 
 
-int read_block(block_num_t block_num, void* buf) {
-  // go to the block
-  if (lseek(disk_fd, block_num * BLOCK_SIZE, SEEK_SET) < 0) {
+int raw_mount(const char* filename) {
+  return open_disk(filename, 0);
+}
+
+
+int raw_mount_shared(const char* filename) {
+  return open_disk(filename, 1);
+}
+
+
+int raw_is_shared() {
+  return shared != NULL;
+}
+
+
+static int in_checksum_table(block_num_t block_num) {
+  return block_num >= crc_first && block_num < crc_first + CHECKSUM_BLOCKS;
+}
+
+
+// looks up the checksum recorded for a block
+static int stored_crc(block_num_t block_num, uint32_t* crc) {
+  if (shared == NULL) {
+    *crc = crcs[block_num];
+    return 0;
+  }
+  uint32_t entries[CHECKSUM_ENTRIES];
+  if (fetch_block(crc_first + block_num / CHECKSUM_ENTRIES, entries) < 0) {
     return -1;
   }
+  *crc = entries[block_num % CHECKSUM_ENTRIES];
+  return 0;
+}
+
+
+// checks a block that was just read from the disk against its checksum
+static int verify_block(block_num_t block_num, const void* buf) {
+  if (crc_first == 0 || in_checksum_table(block_num)) {
+    return 0;
+  }
+  uint32_t crc;
+  if (stored_crc(block_num, &crc) < 0) {
+    return -1;
+  }
+  if (crc32c(0, buf, BLOCK_SIZE) == crc) {
+    return 0;
+  }
+  STATS_INC(checksum_errors);
+  errno = EIO;
+  return -1;
+}
+
+
+// records the checksum of a block that is being written, and writes its table block
+static int update_crc(block_num_t block_num, const void* buf) {
+  if (crc_first == 0 || in_checksum_table(block_num)) {
+    return 0;
+  }
+  uint32_t crc = crc32c(0, buf, BLOCK_SIZE);
+  block_num_t table_block = crc_first + block_num / CHECKSUM_ENTRIES;
+  STATS_INC(block_writes);
+  if (shared == NULL) {
+    crcs[block_num] = crc;
+    return store_block(table_block, crcs + (table_block - crc_first) * CHECKSUM_ENTRIES);
+  }
+  uint32_t entries[CHECKSUM_ENTRIES];
+  raw_lock_block(table_block);
+  int ret = fetch_block(table_block, entries);
+  if (ret == 0) {
+    entries[block_num % CHECKSUM_ENTRIES] = crc;
+    ret = store_block(table_block, entries);
+  }
+  raw_unlock_block(table_block);
+  return ret;
+}
+
+
+int read_block(block_num_t block_num, void* buf) {
+  STATS_INC(block_reads);
+  return fetch_block(block_num, buf);
+}
+
+
+// read_block without the counting
+static int fetch_block(block_num_t block_num, void* buf) {
+  if (tx_blocks != NULL && BIT_TEST(tx_valid, block_num)) {
+    memcpy(buf, tx_blocks + block_num * BLOCK_SIZE, BLOCK_SIZE);
+    return 0;
+  }
+  if (shared != NULL) {
+    lock_shared_mutex(&shared->block_locks[block_num]);
+    int ret = 0;
+    if (!shared->valid[block_num]) {
+      io_begin();
+      ret = dev.ops->read(&dev, shared->blocks[block_num], BLOCK_SIZE, (off_t) block_num * BLOCK_SIZE);
+      io_end();
+      if (ret == 0 && verify_block(block_num, shared->blocks[block_num]) == 0) {
+        shared->valid[block_num] = 1;
+      } else {
+        ret = -1;
+      }
+    }
+    if (ret == 0) {
+      memcpy(buf, shared->blocks[block_num], BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&shared->block_locks[block_num]);
+    return ret;
+  }
+
   // read the block
-  int ret = read(disk_fd, buf, BLOCK_SIZE);
-  if (ret != BLOCK_SIZE) {
+  io_begin();
+  int ret = dev.ops->read(&dev, buf, BLOCK_SIZE, (off_t) block_num * BLOCK_SIZE);
+  io_end();
+  if (ret < 0 || verify_block(block_num, buf) < 0) {
     return -1;
   }
+  if (tx_blocks != NULL) {
+    memcpy(tx_blocks + block_num * BLOCK_SIZE, buf, BLOCK_SIZE);
+    BIT_SET(tx_valid, block_num);
+  }
   return 0;
 }
 
 
+int read_blocks(const block_num_t* block_nums, int count, void* buf) {
+  if (shared != NULL) {
+    // the blocks come out of the shared cache one at a time
+    for (int i = 0; i < count; i++) {
+      if (read_block(block_nums[i], (char*) buf + i * BLOCK_SIZE) < 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  // blocks that aren't cached are read in one batch, adjacent ones together
+  STATS_ADD(block_reads, count);
+  struct disk_io* ios = malloc(count * sizeof(struct disk_io));
+  int num_ios = 0;
+  for (int i = 0; i < count; i++) {
+    char* dest = (char*) buf + i * BLOCK_SIZE;
+    off_t offset = (off_t) block_nums[i] * BLOCK_SIZE;
+    if (tx_blocks != NULL && BIT_TEST(tx_valid, block_nums[i])) {
+      memcpy(dest, tx_blocks + offset, BLOCK_SIZE);
+    } else if (num_ios > 0 && (char*) ios[num_ios - 1].buf + ios[num_ios - 1].len == dest
+               && ios[num_ios - 1].offset + (off_t) ios[num_ios - 1].len == offset) {
+      ios[num_ios - 1].len += BLOCK_SIZE;
+    } else {
+      ios[num_ios++] = (struct disk_io) {dest, BLOCK_SIZE, offset};
+    }
+  }
+  io_begin();
+  int ret = backend_submit(&dev, ios, num_ios, 0);
+  io_end();
+  free(ios);
+  for (int i = 0; i < count && ret == 0; i++) {
+    ret = verify_block(block_nums[i], (char*) buf + i * BLOCK_SIZE);
+  }
+  if (ret == 0 && tx_blocks != NULL) {
+    for (int i = 0; i < count; i++) {
+      memcpy(tx_blocks + block_nums[i] * BLOCK_SIZE, (char*) buf + i * BLOCK_SIZE, BLOCK_SIZE);
+      BIT_SET(tx_valid, block_nums[i]);
+    }
+  }
+  return ret;
+}
+
+
 int write_block(block_num_t block_num, void* buf) {
-  // go to the block
-  if (lseek(disk_fd, block_num * BLOCK_SIZE, SEEK_SET) < 0) {
+  STATS_INC(block_writes);
+  if (store_block(block_num, buf) < 0) {
     return -1;
   }
+  return update_crc(block_num, buf);
+}
+
+
+// write_block without the counting and the checksum
+static int store_block(block_num_t block_num, void* buf) {
+  if (tx_blocks != NULL) {
+    memcpy(tx_blocks + block_num * BLOCK_SIZE, buf, BLOCK_SIZE);
+    BIT_SET(tx_valid, block_num);
+    BIT_SET(tx_dirty, block_num);
+    return 0;
+  }
+  if (shared != NULL) {
+    // write through, so the image is always up to date for the next private mount
+    lock_shared_mutex(&shared->block_locks[block_num]);
+    io_begin();
+    int ret = dev.ops->write(&dev, buf, BLOCK_SIZE, (off_t) block_num * BLOCK_SIZE);
+    dirty = 1;
+    io_end();
+    if (ret == 0) {
+      memcpy(shared->blocks[block_num], buf, BLOCK_SIZE);
+      shared->valid[block_num] = 1;
+    } else {
+      shared->valid[block_num] = 0;
+    }
+    pthread_mutex_unlock(&shared->block_locks[block_num]);
+    return ret;
+  }
+
   // write the block
-  int ret = write(disk_fd, buf, BLOCK_SIZE);
-  if (ret != BLOCK_SIZE) {
+  io_begin();
+  int ret = dev.ops->write(&dev, buf, BLOCK_SIZE, (off_t) block_num * BLOCK_SIZE);
+  dirty = 1;
+  io_end();
+  return ret;
+}
+
+
+void raw_lock_block(block_num_t block_num) {
+  if (shared != NULL) {
+    lock_shared_mutex(&shared->op_locks[block_num]);
+  }
+}
+
+
+void raw_unlock_block(block_num_t block_num) {
+  if (shared != NULL) {
+    pthread_mutex_unlock(&shared->op_locks[block_num]);
+  }
+}
+
+
+void raw_lock_rename() {
+  if (shared != NULL) {
+    lock_shared_mutex(&shared->rename_lock);
+  }
+}
+
+
+void raw_unlock_rename() {
+  if (shared != NULL) {
+    pthread_mutex_unlock(&shared->rename_lock);
+  }
+}
+
+
+int raw_begin() {
+  // a shared mount can't hold back writes, the other processes wouldn't see them
+  if (tx_blocks != NULL || !mounted || shared != NULL) {
+    return -1;
+  }
+  tx_blocks = (char*) malloc(NUM_BLOCKS * BLOCK_SIZE);
+  if (tx_blocks == NULL) {
+    return -1;
+  }
+  memset(tx_valid, 0, sizeof(tx_valid));
+  memset(tx_dirty, 0, sizeof(tx_dirty));
+  return 0;
+}
+
+
+int raw_commit() {
+  if (tx_blocks == NULL) {
+    return -1;
+  }
+  // every run of dirty blocks becomes one request, and they all go in one batch
+  struct disk_io ios[NUM_BLOCKS / 2];
+  int num_ios = 0;
+  for (int first = 0; first < NUM_BLOCKS; ) {
+    if (!BIT_TEST(tx_dirty, first)) {
+      first++;
+      continue;
+    }
+    int end = first + 1;
+    while (end < NUM_BLOCKS && BIT_TEST(tx_dirty, end)) {
+      end++;
+    }
+    ios[num_ios++] = (struct disk_io) {tx_blocks + first * BLOCK_SIZE, (end - first) * BLOCK_SIZE,
+                                       (off_t) first * BLOCK_SIZE};
+    first = end;
+  }
+  io_begin();
+  int ret = backend_submit(&dev, ios, num_ios, 1);
+  dirty = 1;
+  io_end();
+  free(tx_blocks);
+  tx_blocks = NULL;
+  return ret;
+}
+
+
+int raw_checksums(block_num_t first, int init) {
+  crc_first = 0;
+  if (first == 0) {
+    return 0;
+  }
+  if (init) {
+    // every block that isn't part of the table gets the checksum of its current contents
+    uint32_t table[NUM_BLOCKS];
+    char buf[BLOCK_SIZE];
+    memset(table, 0, sizeof(table));
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+      if (b >= first && b < first + CHECKSUM_BLOCKS) {
+        continue;
+      }
+      if (fetch_block(b, buf) < 0) {
+        return -1;
+      }
+      table[b] = crc32c(0, buf, BLOCK_SIZE);
+    }
+    for (int i = 0; i < CHECKSUM_BLOCKS; i++) {
+      STATS_INC(block_writes);
+      if (store_block(first + i, table + i * CHECKSUM_ENTRIES) < 0) {
+        return -1;
+      }
+    }
+  }
+  if (shared == NULL) {
+    for (int i = 0; i < CHECKSUM_BLOCKS; i++) {
+      STATS_INC(block_reads);
+      if (fetch_block(first + i, crcs + i * CHECKSUM_ENTRIES) < 0) {
+        return -1;
+      }
+    }
+  }
+  crc_first = first;
+  return 0;
+}
+
+
+// flushes if anything was written since the last flush; called with io_lock held if the flusher runs
+static int flush_dirty() {
+  if (!dirty) {
+    return 0;
+  }
+  dirty = 0;
+  STATS_INC(flushes);
+  int ret = dev.ops->flush(&dev);
+  if (ret < 0) {
+    dirty = 1;
+  }
+  return ret;
+}
+
+
+int raw_flush() {
+  if (!mounted) {
+    return -1;
+  }
+  io_begin();
+  int ret = flush_dirty();
+  io_end();
+  return ret;
+}
+
+
+static void* flusher_main(void* arg) {
+  (void) arg;
+  pthread_mutex_lock(&io_lock);
+  while (!flusher_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += flush_interval_ms / 1000;
+    deadline.tv_nsec += (long) (flush_interval_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&flusher_wake, &io_lock, &deadline);
+    flush_dirty();
+  }
+  pthread_mutex_unlock(&io_lock);
+  return NULL;
+}
+
+
+int raw_flush_interval(int interval_ms) {
+  if (flusher_running) {
+    pthread_mutex_lock(&io_lock);
+    flusher_stop = 1;
+    pthread_cond_signal(&flusher_wake);
+    pthread_mutex_unlock(&io_lock);
+    pthread_join(flusher, NULL);
+    flusher_running = 0;
+  }
+  if (interval_ms <= 0) {
+    return 0;
+  }
+  if (!mounted) {
+    return -1;
+  }
+  flush_interval_ms = interval_ms;
+  flusher_stop = 0;
+  flusher_running = 1;
+  if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+    flusher_running = 0;
     return -1;
   }
   return 0;
@@ -76,6 +598,40 @@ int write_block(block_num_t block_num, void* buf) {
 
 
 int raw_unmount() {
+  if (!mounted) {
+    return -1;
+  }
+  if (tx_blocks != NULL) {
+    raw_commit();
+  }
+  raw_flush_interval(0);
+  dirty = 0;
+  if (shared != NULL) {
+    // the last process to unmount removes the shared cache
+    lock_byte(SETUP_LOCK_BYTE, F_WRLCK, 1);
+    if (lock_byte(MOUNT_LOCK_BYTE, F_WRLCK, 0) == 0) {
+      shm_unlink(shared_name);
+    }
+    munmap(shared, sizeof(struct shared_cache));
+    shared = NULL;
+  }
   disk_filename = NULL;
-  return close(disk_fd);
+  mounted = 0;
+  crc_first = 0;
+  return dev.ops->unmount(&dev); // closing the file also drops the advisory locks
+}
+
+
+int raw_remove(const char* filename) {
+  return backend_remove(filename);
+}
+
+
+int raw_uncache(const char* filename) {
+  return backend_uncache(filename);
+}
+
+
+int raw_exists(const char* filename) {
+  return backend_exists(filename);
 }
@@ -6,13 +6,37 @@
 #define BLOCK_SIZE 64
 #define NUM_BLOCKS (8 * BLOCK_SIZE)
 
+// number of blocks in the checksum table (a 32-bit CRC per disk block)
+#define CHECKSUM_BLOCKS (NUM_BLOCKS * 4 / BLOCK_SIZE)
+
 // block_num_t is the data type for a block number
 // and is a 16-bit unsigned integer
 typedef uint16_t block_num_t;
 
 
+/* raw_mount
+ *   opens the disk image (creating it if needed) for this process alone; it
+ *   fails if another process has the image mounted
+ * filename - the image file, or another kind of storage given by a prefix,
+ *   e.g. "ram:" (see disk_backend.h)
+ * returns 0 on success or -1 on failure
+ */
 int raw_mount(const char* filename);
 
+/* raw_mount_shared
+ *   opens the disk image so that several processes can mount it at once;
+ *   they share one block cache in shared memory, and writes go through the
+ *   cache to the image (it fails if another process has the image mounted
+ *   with raw_mount)
+ * returns 0 on success or -1 on failure
+ */
+int raw_mount_shared(const char* filename);
+
+/* raw_is_shared
+ *   returns 1 if the disk was mounted with raw_mount_shared(), 0 otherwise
+ */
+int raw_is_shared();
+
 /* read_block
  *   reads a block from the disk
  * block_num - number of the block to read
@@ -22,6 +46,16 @@ int raw_mount(const char* filename);
  */
 int read_block(block_num_t block_num, void* buf);
 
+/* read_blocks
+ *   reads several blocks at once; the ones that have to come from the disk
+ *   are read in one batch (in parallel, for a striped image)
+ * block_nums - numbers of the blocks to read
+ * count - how many there are
+ * buf - block i is copied to buf + i * BLOCK_SIZE
+ * returns 0 on success or -1 on failure
+ */
+int read_blocks(const block_num_t* block_nums, int count, void* buf);
+
 /* write_block
  *   writes a block to the disk
  * block_num - number of the block to write
@@ -31,7 +65,89 @@ int read_block(block_num_t block_num, void* buf);
  */
 int write_block(block_num_t block_num, void* buf);
 
+/* raw_lock_block / raw_unlock_block
+ *   take and release the lock of a block that is shared by all processes
+ *   with the image mounted, so a multi-block update (e.g. of a directory and
+ *   the bitmap) is not interleaved with another process's; the lock is
+ *   recursive, and both functions do nothing unless the mount is shared
+ */
+void raw_lock_block(block_num_t block_num);
+void raw_unlock_block(block_num_t block_num);
+
+/* raw_lock_rename / raw_unlock_rename
+ *   take and release one lock shared by all processes with the image
+ *   mounted, held by a move from one directory to another so that no other
+ *   such move changes which directory is below which in the meantime; both
+ *   functions do nothing unless the mount is shared
+ */
+void raw_lock_rename();
+void raw_unlock_rename();
+
+/* raw_begin
+ *   starts a transaction: until raw_commit() is called, written blocks are
+ *   only kept in memory (and blocks that are read are cached), so a block
+ *   that is written many times reaches the disk once
+ * returns 0 on success or -1 on failure (e.g. a transaction is already open,
+ *   or the mount is shared)
+ */
+int raw_begin();
+
+/* raw_commit
+ *   ends the transaction started by raw_begin(), writing every dirty block to
+ *   the disk in block order (runs of adjacent blocks are written together)
+ * returns 0 on success or -1 on failure (e.g. no transaction is open)
+ */
+int raw_commit();
+
+/* raw_checksums
+ *   turns checking of block checksums on or off: while it is on, every block
+ *   read from the disk is checked against its CRC-32C in the checksum table
+ *   (read_block fails with errno EIO on a mismatch), and write_block records
+ *   the checksum of every block it writes
+ * first - first block of the CHECKSUM_BLOCKS-block table, or 0 to turn
+ *   checking off
+ * init - nonzero if the table is new and has to be filled in from the
+ *   current contents of the disk, 0 if it is up to date
+ * returns 0 on success or -1 on failure
+ */
+int raw_checksums(block_num_t first, int init);
+
+/* raw_flush
+ *   makes sure the blocks written so far are on stable storage (blocks held
+ *   back by an open transaction aren't written yet); all the writes since
+ *   the last flush are covered by a single fdatasync (none if there were none)
+ * returns 0 on success or -1 on failure
+ */
+int raw_flush();
+
+/* raw_flush_interval
+ *   starts a background thread that calls raw_flush every interval_ms
+ *   milliseconds, or stops it if interval_ms is 0 (raw_unmount stops it too)
+ * returns 0 on success or -1 on failure
+ */
+int raw_flush_interval(int interval_ms);
+
 int raw_unmount();
 
+/* raw_remove
+ *   deletes a disk image that isn't mounted (all its files, for a striped one)
+ * returns 0 on success or -1 on failure
+ */
+int raw_remove(const char* filename);
+
+/* raw_uncache
+ *   drops the host's cached pages of a disk image that isn't mounted, so
+ *   that it is read from the device again (see backend_uncache)
+ * returns 0 on success or -1 on failure
+ */
+int raw_uncache(const char* filename);
+
+/* raw_exists
+ *   checks whether a disk image is there without creating it, as mounting it
+ *   would (see backend_exists)
+ * returns 0 if it is or -1 (with errno set) if it isn't
+ */
+int raw_exists(const char* filename);
+
 #endif // _RAW_DISK_H_
 
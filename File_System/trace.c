@@ -0,0 +1,75 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+int trace_enabled = 0;
+
+static FILE* trace_file = NULL;
+static uint64_t last_start = 0;
+static int write_failed = 0;
+
+static const char* trace_names[NUM_TRACE_OPS - NUM_FS_OPS] = {
+  "sync", "begin", "commit", "setcwd", "dedup", "checksums", "defer", "durability"
+};
+
+
+int trace_open(const char* path) {
+  if (trace_file != NULL) {
+    trace_close();
+  }
+  trace_file = fopen(path, "wb");
+  if (trace_file == NULL) {
+    return -1;
+  }
+  // records are small, so they are collected into large writes
+  setvbuf(trace_file, NULL, _IOFBF, 64 * 1024);
+  uint32_t version = TRACE_VERSION;
+  write_failed = fwrite(TRACE_MAGIC, 4, 1, trace_file) != 1
+              || fwrite(&version, sizeof(version), 1, trace_file) != 1;
+  last_start = 0;
+  trace_enabled = 1;
+  return 0;
+}
+
+
+int trace_close() {
+  if (trace_file == NULL) {
+    return 0;
+  }
+  trace_enabled = 0;
+  int ret = (fclose(trace_file) == 0 && !write_failed) ? 0 : -1;
+  trace_file = NULL;
+  return ret;
+}
+
+
+const char* trace_op_name(int op) {
+  if (op >= 0 && op < NUM_FS_OPS) {
+    return stats_op_name(op);
+  }
+  return (op >= NUM_FS_OPS && op < NUM_TRACE_OPS) ? trace_names[op - NUM_FS_OPS] : "unknown";
+}
+
+
+void trace_call(int op, uint64_t start, int ret, int arg, int count,
+                const char* name, const char* name2, const void* data, int data_len) {
+  uint64_t ns = stats_now_ns() - start;
+  size_t name_len = name != NULL ? strlen(name) + 1 : 0;
+  size_t name2_len = name2 != NULL ? strlen(name2) + 1 : 0;
+  struct trace_record rec;
+  rec.op = op;
+  rec.arg = arg;
+  rec.ret = ret;
+  rec.count = count;
+  rec.payload = name_len + name2_len + data_len;
+  rec.gap_us = last_start != 0 ? (start - last_start) / 1000 : 0;
+  rec.duration_ns = ns > UINT32_MAX ? UINT32_MAX : ns;
+  last_start = start;
+
+  if (fwrite(&rec, sizeof(rec), 1, trace_file) != 1
+      || (name_len && fwrite(name, name_len, 1, trace_file) != 1)
+      || (name2_len && fwrite(name2, name2_len, 1, trace_file) != 1)
+      || (data_len && fwrite(data, data_len, 1, trace_file) != 1)) {
+    write_failed = 1;
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "fs_stats.h"
+
+/* A trace records every jfs_* call made while it is open, with its arguments,
+ * result and timing, so that jfs_replay can run the same calls again.  The
+ * file starts with TRACE_MAGIC and a uint32_t TRACE_VERSION, followed by one
+ * struct trace_record per call, each followed by its payload (all in host
+ * byte order):
+ *   the name (the source path of a rename), NUL terminated, if the call has one
+ *   the destination path of a rename, NUL terminated
+ *   the data of a write (count bytes)
+ *   the interval of jfs_durability (uint32_t)
+ * A chdir with no payload is a chdir(NULL).
+ */
+
+#define TRACE_MAGIC "JFST"
+#define TRACE_VERSION 1
+
+// the calls that are not one of the fs_op operations
+enum trace_op {
+  TRACE_SYNC = NUM_FS_OPS,
+  TRACE_BEGIN,
+  TRACE_COMMIT,
+  TRACE_SETCWD,     // count: the directory handle
+  TRACE_DEDUP,      // arg: enable
+  TRACE_CHECKSUMS,  // arg: enable
+  TRACE_DEFER,      // arg: enable
+  TRACE_DURABILITY, // arg: mode, payload: the interval
+  NUM_TRACE_OPS
+};
+
+struct trace_record {
+  uint8_t op;           // enum fs_op or enum trace_op
+  uint8_t arg;          // see enum trace_op; compress: enable
+  int16_t ret;          // what the call returned
+  uint16_t count;       // write: bytes written, read: bytes asked for, fallocate: size
+  uint16_t payload;     // bytes that follow the record
+  uint32_t gap_us;      // from the start of the previous call to the start of this one
+  uint32_t duration_ns; // how long the call took (at most UINT32_MAX)
+};
+
+// like stats_enabled, a single branch per call while no trace is open
+extern int trace_enabled;
+
+/* trace_open
+ *   starts writing a trace of the calls that follow to path (replacing it)
+ * returns 0 on success or -1 on error (errno is set)
+ */
+int trace_open(const char* path);
+
+/* trace_close
+ *   writes what is still buffered and closes the trace
+ * returns 0 on success or -1 if the trace could not be written completely
+ */
+int trace_close();
+
+/* trace_op_name
+ *   returns the name of an fs_op or trace_op
+ */
+const char* trace_op_name(int op);
+
+/* trace_begin / trace_end
+ *   bracket one call: trace_begin returns the start time (0 when no trace is
+ *   open) to pass to trace_end along with the result and the arguments
+ *   (trace_call does the work when a trace is open)
+ */
+void trace_call(int op, uint64_t start, int ret, int arg, int count,
+                const char* name, const char* name2, const void* data, int data_len);
+
+static inline uint64_t trace_begin() {
+  return trace_enabled ? stats_now_ns() : 0;
+}
+
+static inline void trace_end(int op, uint64_t start, int ret, int arg, int count,
+                             const char* name, const char* name2, const void* data, int data_len) {
+  if (trace_enabled && start != 0) {
+    trace_call(op, start, ret, arg, count, name, name2, data, data_len);
+  }
+}
+
+#endif // _TRACE_H_
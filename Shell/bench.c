@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+//jsh_bench: feeds a shell script of identical pipelines to a jsh and times it, then pushes
+//data through a pipeline of cats with the default and with enlarged pipe buffers;
+//prints one JSON object per pipeline length and per pipe size
+
+#define DEFAULT_SHELL "./shell"
+#define DEFAULT_PIPELINES 500
+#define DEFAULT_STAGE "/bin/true"
+#define DEFAULT_MEGABYTES 512
+#define DEFAULT_CATS 3
+#define DEFAULT_PIPE_SIZE (1024 * 1024)
+
+double nowSeconds(void);
+char *makeScript(const char *stage, int pipelines, int stages, size_t *size);
+double runShell(const char *shell, const char *script, size_t size);
+int throughput(const char *shell, int megabytes, int cats, int pipeSize);
+
+void usage(void)
+{
+    fprintf(stderr, "usage: jsh_bench [-s shell] [-c command] [-n pipelines] [-m megabytes] [-k cats] [-p pipe_size] [stages...]\n");
+    fprintf(stderr, "  -s shell      the jsh to run (default %s)\n", DEFAULT_SHELL);
+    fprintf(stderr, "  -c command    the command every stage runs (default %s; a bare name is looked up in PATH)\n", DEFAULT_STAGE);
+    fprintf(stderr, "  -n pipelines  pipelines per run (default %d)\n", DEFAULT_PIPELINES);
+    fprintf(stderr, "  -m megabytes  data pushed through head | cat | ... > /dev/null (default %d, 0 to skip)\n", DEFAULT_MEGABYTES);
+    fprintf(stderr, "  -k cats       cat stages in that pipeline (default %d)\n", DEFAULT_CATS);
+    fprintf(stderr, "  -p pipe_size  the enlarged pipe size it is also run with (default %d)\n", DEFAULT_PIPE_SIZE);
+    fprintf(stderr, "  stages        pipeline lengths to measure (default 1 4 16)\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *shell = DEFAULT_SHELL;
+    const char *stage = DEFAULT_STAGE;
+    int pipelines = DEFAULT_PIPELINES;
+    int megabytes = DEFAULT_MEGABYTES;
+    int cats = DEFAULT_CATS;
+    int pipeSize = DEFAULT_PIPE_SIZE;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:n:m:k:p:")) != -1) {
+        if (opt == 's') {
+            shell = optarg;
+        } else if (opt == 'c') {
+            stage = optarg;
+        } else if (opt == 'n' && atoi(optarg) > 0) {
+            pipelines = atoi(optarg);
+        } else if (opt == 'm' && atoi(optarg) >= 0) {
+            megabytes = atoi(optarg);
+        } else if (opt == 'k' && atoi(optarg) >= 0) {
+            cats = atoi(optarg);
+        } else if (opt == 'p' && atoi(optarg) > 0) {
+            pipeSize = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    int defaults[] = {1, 4, 16};
+    int runs = optind < argc ? argc - optind : 3;
+    for (int r = 0; r < runs; r++) {
+        int stages = optind < argc ? atoi(argv[optind + r]) : defaults[r];
+        if (stages <= 0) {
+            usage();
+        }
+        size_t size;
+        char *script = makeScript(stage, pipelines, stages, &size);
+        double seconds = runShell(shell, script, size);
+        free(script);
+        if (seconds < 0) {
+            return 1;
+        }
+        printf("{\"workload\":\"pipeline\",\"command\":\"%s\",\"stages\":%d,\"pipelines\":%d,\"seconds\":%.3f,"
+               "\"pipelines_per_sec\":%.0f,\"commands_per_sec\":%.0f}\n",
+               stage, stages, pipelines, seconds, pipelines / seconds, (double)pipelines * stages / seconds);
+    }
+    if (megabytes > 0 && (throughput(shell, megabytes, cats, 0) == -1
+                          || throughput(shell, megabytes, cats, pipeSize) == -1)) {
+        return 1;
+    }
+    return 0;
+}
+
+//time moving megabytes through head, cats cats and a redirection to /dev/null, with the pipes
+//between them set to pipeSize bytes (0: the default)
+int throughput(const char *shell, int megabytes, int cats, int pipeSize)
+{
+    char script[256 + 6 * cats];
+    char *p = script;
+    p += sprintf(p, "pipesize %d\nhead -c %dM /dev/zero", pipeSize, megabytes);
+    for (int i = 0; i < cats; i++) {
+        p += sprintf(p, " | cat");
+    }
+    p += sprintf(p, " > /dev/null\nexit\n");
+    double seconds = runShell(shell, script, p - script);
+    if (seconds < 0) {
+        return -1;
+    }
+    printf("{\"workload\":\"throughput\",\"stages\":%d,\"pipe_size\":%d,\"megabytes\":%d,\"seconds\":%.3f,"
+           "\"mb_per_sec\":%.0f}\n",
+           cats + 1, pipeSize, megabytes, seconds, megabytes / seconds);
+    return 0;
+}
+
+double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//pipelines lines of "stage | stage | ..." followed by exit
+char *makeScript(const char *stage, int pipelines, int stages, size_t *size)
+{
+    size_t line = stages * (strlen(stage) + 3);
+    char *script = malloc(pipelines * line + sizeof("exit\n"));
+    char *p = script;
+    for (int i = 0; i < pipelines; i++) {
+        for (int j = 0; j < stages; j++) {
+            p += sprintf(p, j < stages - 1 ? "%s | " : "%s\n", stage);
+        }
+    }
+    p += sprintf(p, "exit\n");
+    *size = p - script;
+    return script;
+}
+
+//runs shell with script as its input (and its output thrown away) and returns the seconds it took
+double runShell(const char *shell, const char *script, size_t size)
+{
+    int in[2];
+    if (pipe(in) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    double start = nowSeconds();
+    int rc = fork();
+    if (rc < 0) {
+        perror("fork");
+        return -1;
+    } else if (rc == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(in[0], STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(null);
+        execl(shell, shell, (char *)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    close(in[0]);
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = write(in[1], script + done, size - done);
+        if (n < 0) {
+            perror("write");
+            break;
+        }
+        done += n;
+    }
+    close(in[1]);
+    int wstatus;
+    waitpid(rc, &wstatus, 0);
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        fprintf(stderr, "%s did not finish the script\n", shell);
+        return -1;
+    }
+    return nowSeconds() - start;
+}
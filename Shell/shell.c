@@ -1,122 +1,1062 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
-int splitPipes(char* input, char *pros[]);
-int splitArgs(char* input, char *args[]);
+//a command line is parsed in one pass into words and arrays taken from an arena, which is
+//emptied (but kept) before the next line, so parsing doesn't allocate once lines stop growing
+#define ARENA_BLOCK_SIZE 4096
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+void *arenaAlloc(size_t size);
+void arenaReset(void);
+
+//[n]<file, [n]>file, [n]>>file or [n]>&m (also <&m), applied in order after the pipes are set up
+struct redirect {
+    int fd;             //the descriptor redirected
+    int flags;          //open flags for file, or -1 to duplicate dupFd
+    int dupFd;
+    char *file;
+};
+struct stage {
+    int argc;
+    char **argv;        //NULL terminated
+    int nredirs;
+    struct redirect *redirs;
+};
+struct commandLine {
+    int nstages;        //0 for an empty line
+    struct stage *stages;
+    bool background;    //it ended with &
+    bool timed;         //it started with time
+    int start, end;     //where the command is in the line (without the &), for jobs to show
+};
+int parseLine(const char *line, struct commandLine *cmd);
 void closeAll(int fd[][2], int len);
+int spawnCommand(const struct stage *st, int in, int out, pid_t pgid, bool foreground);
+int checkRedirects(const struct stage *st);
+int applyRedirects(const struct stage *st, int saved[]);
+void restoreRedirects(const struct stage *st, int saved[]);
+
+//job control: every command line that isn't a lone builtin runs as a job; when the shell reads
+//from a terminal each job gets a process group of its own, which holds the terminal while the
+//job is in the foreground. Children are reaped by the SIGCHLD handler, and the job table is only
+//changed with SIGCHLD blocked.
+struct process {
+    pid_t pid;          //-1 if it couldn't be started
+    int status;         //wait status, once it has exited
+    bool exited;
+    bool stopped;
+    struct rusage usage;    //what it used, from wait4, once it has exited
+    struct timespec end;    //when it was reaped
+    char *name;             //its command, for time
+};
+struct job {
+    int id;
+    pid_t pgid;         //0 without job control
+    char *line;
+    int nprocs;
+    struct process *procs;
+    bool notified;      //its stop has been reported
+    bool timed;         //report what every stage used when it finishes
+    struct timespec start;
+};
+void initJobControl(void);
+struct job *launchJob(const struct commandLine *cmd, const char *line);
+int waitForeground(struct job *job);
+void reportJobs(void);
+
+//resource use, for time and for the session totals stats prints
+struct usageTotals {
+    long processes;
+    double wall;        //of jobs: from the start of the first stage to the end of the last one
+    double user;
+    double sys;
+    long maxRss;        //kB, the largest of any process
+    long voluntarySwitches;
+    long involuntarySwitches;
+};
+void addUsage(struct usageTotals *totals, const struct rusage *usage);
+void printTimes(const struct job *job);
+
+//the session's totals for stats, over the jobs that have finished
+static struct usageTotals sessionTotals;
+static long jobsRun = 0;
+static long builtinsRun = 0;
+
+//the command location cache: where in PATH each command name was found, so that
+//PATH is only searched the first time a command runs
+#define HASH_BUCKETS 64
+struct hashEntry {
+    char *name;
+    char *path;
+    int hits;
+    struct hashEntry *next;
+};
+const char *hashLookup(const char *name);
+void hashForget(const char *name);
+void hashReset(void);
+
+//builtins run inside the shell (or inside the forked child when they are piped)
+typedef int (*builtinFunc)(int argc, char *args[]);
+struct builtin {
+    const char *name;
+    builtinFunc func;
+};
+builtinFunc findBuiltin(const char *name);
+int builtinCd(int argc, char *args[]);
+int builtinPwd(int argc, char *args[]);
+int builtinEcho(int argc, char *args[]);
+int builtinTrue(int argc, char *args[]);
+int builtinFalse(int argc, char *args[]);
+int builtinExport(int argc, char *args[]);
+int builtinExit(int argc, char *args[]);
+int builtinHash(int argc, char *args[]);
+int builtinJobs(int argc, char *args[]);
+int builtinFg(int argc, char *args[]);
+int builtinBg(int argc, char *args[]);
+int builtinWait(int argc, char *args[]);
+int builtinPipesize(int argc, char *args[]);
+int builtinStats(int argc, char *args[]);
+
+static const struct builtin builtins[] = {
+    {"cd", builtinCd},
+    {"pwd", builtinPwd},
+    {"echo", builtinEcho},
+    {"true", builtinTrue},
+    {"false", builtinFalse},
+    {"export", builtinExport},
+    {"exit", builtinExit},
+    {"hash", builtinHash},
+    {"jobs", builtinJobs},
+    {"fg", builtinFg},
+    {"bg", builtinBg},
+    {"wait", builtinWait},
+    {"pipesize", builtinPipesize},
+    {"stats", builtinStats},
+};
 
 int main(void) 
 {
+    initJobControl();
+    //the line buffer grows to the longest line read and is reused
+    char *input = NULL;
+    size_t inputSize = 0;
     while (true) {
         //get the user's input
-        char input[1000] = {0};
+        reportJobs();
         printf("jsh$ ");
-        fgets(input, 1000, stdin);
-        if(input[0] == '\n') {
+        fflush(stdout);
+        //end of input works like exit
+        if (getline(&input, &inputSize, stdin) == -1) {
+            return 0;
+        }
+        arenaReset();
+        struct commandLine cmd;
+        if (parseLine(input, &cmd) == -1) {
+            printf("jsh status: 2\n");
+            continue;
+        }
+        if (cmd.nstages == 0) {
+            continue;
+        }
+        //a builtin on its own runs in the shell itself, so cd and export can change it
+        builtinFunc builtin = cmd.nstages == 1 && !cmd.background ? findBuiltin(cmd.stages[0].argv[0]) : NULL;
+        if (builtin != NULL) {
+            //its redirections are undone afterwards, since they are the shell's own descriptors
+            const struct stage *st = &cmd.stages[0];
+            int *saved = arenaAlloc(st->nredirs * sizeof(int));
+            //a timed builtin is measured as what the shell used while running it
+            struct job timing = {.nprocs = 1, .timed = true};
+            struct process self = {.name = st->argv[0]};
+            struct rusage before;
+            if (cmd.timed) {
+                timing.line = arenaAlloc(cmd.end - cmd.start + 1);
+                memcpy(timing.line, input + cmd.start, cmd.end - cmd.start);
+                timing.line[cmd.end - cmd.start] = '\0';
+                timing.procs = &self;
+                clock_gettime(CLOCK_MONOTONIC, &timing.start);
+                getrusage(RUSAGE_SELF, &before);
+            }
+            int status = applyRedirects(st, saved) == -1 ? 1 : builtin(st->argc, st->argv);
+            fflush(stdout);
+            restoreRedirects(st, saved);
+            builtinsRun++;
+            if (cmd.timed) {
+                clock_gettime(CLOCK_MONOTONIC, &self.end);
+                getrusage(RUSAGE_SELF, &self.usage);
+                self.usage.ru_utime.tv_sec -= before.ru_utime.tv_sec;
+                self.usage.ru_utime.tv_usec -= before.ru_utime.tv_usec;
+                self.usage.ru_stime.tv_sec -= before.ru_stime.tv_sec;
+                self.usage.ru_stime.tv_usec -= before.ru_stime.tv_usec;
+                self.usage.ru_nvcsw -= before.ru_nvcsw;
+                self.usage.ru_nivcsw -= before.ru_nivcsw;
+                printTimes(&timing);
+            }
+            printf("jsh status: %d\n", status);
             continue;
         }
-        //remove /n in the end of input
-        char *tmp = NULL;
-        if ((tmp = strstr(input, "\n")))
-        {
-            *tmp = '\0';
-        }
-        //split input to pros[] by |
-        char* pros[100];
-        int prolen = splitPipes(input, pros);
-        //create pipes
-        int fd[prolen - 1][2];
-        for (int i = 0; i < prolen; i++) {
-            if (pipe(fd[i]) == -1) {
-                printf("error in pipe%d\n", i);
-                return 1;
-            }
-        }        
-        //record PID and command
-        int child[prolen];
-        char *command[prolen];
-        //run programs in order with pipe()
-        for (int i = 0; i < prolen; i++) {
-            //split pros to args[] by space
-            char* args[100];
-            int len = splitArgs(pros[i], args);        
-            //command exit
-            if (len == 1 && strcmp(args[0], "exit") == 0) {
+        struct job *job = launchJob(&cmd, input);
+        //nothing was started, and the session (and its background jobs) carries on
+        if (job == NULL) {
+            printf("jsh status: 1\n");
+            continue;
+        }
+        if (cmd.background) {
+            printf("[%d] %d\n", job->id, (int)job->procs[job->nprocs - 1].pid);
+            continue;
+        }
+        printf("jsh status: %d\n", waitForeground(job));
+    }   
+    return 0;
+}
+
+static struct arenaBlock *arenaFirst = NULL;
+static struct arenaBlock *arenaCurrent = NULL;
+
+//size bytes that stay valid until the next arenaReset
+void *arenaAlloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (arenaCurrent == NULL || arenaCurrent->used + size > arenaCurrent->size) {
+        struct arenaBlock *next = arenaCurrent != NULL ? arenaCurrent->next : arenaFirst;
+        //a block kept from an earlier line that is too small is dropped along with the ones after it
+        if (next != NULL && next->size < size) {
+            while (next != NULL) {
+                struct arenaBlock *gone = next;
+                next = next->next;
+                free(gone);
+            }
+        }
+        if (next == NULL) {
+            size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            next = malloc(sizeof(*next) + blockSize);
+            next->size = blockSize;
+            next->next = NULL;
+            if (arenaCurrent != NULL) {
+                arenaCurrent->next = next;
+            } else {
+                arenaFirst = next;
+            }
+        }
+        next->used = 0;
+        arenaCurrent = next;
+    }
+    void *ptr = arenaCurrent->data + arenaCurrent->used;
+    arenaCurrent->used += size;
+    return ptr;
+}
+
+//free everything arenaAlloc returned, keeping the blocks for the next line
+void arenaReset(void)
+{
+    arenaCurrent = arenaFirst;
+    if (arenaFirst != NULL) {
+        arenaFirst->used = 0;
+    }
+}
+
+static int syntaxError(const char *near)
+{
+    fprintf(stderr, "jsh error: syntax error near %s\n", near);
+    return -1;
+}
+
+//copy the word at *p to *out, NUL terminated, advancing both past it; returns -1 after
+//reporting an unterminated quote
+static int parseWord(const char **p, char **out)
+{
+    const char *in = *p;
+    char *o = *out;
+    while (*in != '\0' && strchr(" \t\n|&<>", *in) == NULL) {
+        if (*in == '\\') {
+            in++;
+            //a \ at the end of the line is dropped
+            if (*in != '\0' && *in != '\n') {
+                *o++ = *in;
+                in++;
+            }
+        } else if (*in == '\'' || *in == '"') {
+            char quote = *in++;
+            while (*in != quote) {
+                if (*in == '\0') {
+                    fprintf(stderr, "jsh error: syntax error near unterminated %c\n", quote);
+                    return -1;
+                }
+                if (quote == '"' && *in == '\\' && in[1] != '\0' && strchr("\\\"$", in[1]) != NULL) {
+                    in++;
+                }
+                *o++ = *in++;
+            }
+            in++;
+        } else {
+            *o++ = *in++;
+        }
+    }
+    *o++ = '\0';
+    *p = in;
+    *out = o;
+    return 0;
+}
+
+//split line into the stages of a pipeline, their words and their redirections: words are
+//separated by spaces and tabs, stages by |, and a final & runs the line in the background.
+//'...' quotes everything up to the next ', "..." everything but \\, \" and \$, and \ outside
+//quotes the next character. returns 0, or -1 after reporting a syntax error
+int parseLine(const char *line, struct commandLine *cmd)
+{
+    //the words take at most one byte per character plus a NUL each, and every word, every
+    //stage's terminating NULL and every redirection starts with a different character of the line
+    size_t len = strlen(line);
+    char *out = arenaAlloc(len + 1);
+    char **slots = arenaAlloc((len + 2) * sizeof(char *));
+    struct stage *stages = arenaAlloc((len + 1) * sizeof(struct stage));
+    struct redirect *redirs = arenaAlloc((len + 1) * sizeof(struct redirect));
+    const char *p = line;
+    int nslots = 0;
+    cmd->nstages = 0;
+    cmd->stages = stages;
+    cmd->background = false;
+    cmd->timed = false;
+    cmd->start = cmd->end = strspn(line, " \t\n");
+    stages[0].argc = 0;
+    stages[0].argv = slots;
+    stages[0].nredirs = 0;
+    stages[0].redirs = redirs;
+    while (true) {
+        p += strspn(p, " \t\n");
+        struct stage *st = &stages[cmd->nstages];
+        if (*p == '\0' || *p == '|' || *p == '&') {
+            if (st->argc == 0) {
+                if (*p == '\0' && cmd->nstages == 0 && st->nredirs == 0) {
                     return 0;
+                }
+                return syntaxError(*p == '|' ? "|" : *p == '&' ? "&" : "end of line");
+            }
+            slots[nslots++] = NULL;
+            redirs += st->nredirs;
+            cmd->nstages++;
+            if (*p == '|') {
+                p++;
+                stages[cmd->nstages].argc = 0;
+                stages[cmd->nstages].argv = &slots[nslots];
+                stages[cmd->nstages].nredirs = 0;
+                stages[cmd->nstages].redirs = redirs;
+                continue;
+            }
+            if (*p == '&') {
+                p++;
+                if (p[strspn(p, " \t\n")] != '\0') {
+                    return syntaxError("&");
+                }
+                cmd->background = true;
+            }
+            //time in front of the line is a keyword, not the first stage's command
+            if (strcmp(stages[0].argv[0], "time") == 0) {
+                if (stages[0].argc == 1) {
+                    return syntaxError("time");
+                }
+                cmd->timed = true;
+                stages[0].argv++;
+                stages[0].argc--;
+            }
+            return 0;
+        }
+        //a redirection, with a single digit in front of it for a descriptor other than 0 or 1
+        const char *op = p;
+        if (*op >= '0' && *op <= '9' && (op[1] == '<' || op[1] == '>')) {
+            op++;
+        }
+        if (*op == '<' || *op == '>') {
+            struct redirect *r = &st->redirs[st->nredirs++];
+            r->fd = op > p ? *p - '0' : *op == '<' ? STDIN_FILENO : STDOUT_FILENO;
+            if (*op == '<') {
+                r->flags = O_RDONLY;
+            } else if (op[1] == '>') {
+                r->flags = O_WRONLY | O_CREAT | O_APPEND;
+                op++;
+            } else {
+                r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+            }
+            p = op + 1;
+            if (*p == '&') {
+                if (p[1] < '0' || p[1] > '9' || strchr(" \t\n|&<>", p[2]) == NULL) {
+                    return syntaxError(op[0] == '<' ? "<&" : ">&");
+                }
+                r->flags = -1;
+                r->dupFd = p[1] - '0';
+                p += 2;
+            } else {
+                p += strspn(p, " \t\n");
+                if (*p == '\0' || strchr("|&<>", *p) != NULL) {
+                    return syntaxError(*op == '<' ? "<" : ">");
+                }
+                r->file = out;
+                if (parseWord(&p, &out) == -1) {
+                    return -1;
+                }
+            }
+            cmd->end = p - line;
+            continue;
+        }
+        //a word
+        slots[nslots++] = out;
+        st->argc++;
+        if (parseWord(&p, &out) == -1) {
+            return -1;
+        }
+        cmd->end = p - line;
+    }
+}
+
+//F_SETPIPE_SZ for the pipes between stages (set with pipesize), 0 for the kernel's default
+static int pipeSize = 0;
+
+static bool jobControl = false;
+static pid_t shellPgid;
+static sigset_t sigchldMask;
+static struct job **jobs = NULL;
+static int numJobs = 0;
+
+//record how a child changed state; called only from the SIGCHLD handler
+static void updateProcess(pid_t pid, int status, const struct rusage *usage)
+{
+    for (int j = 0; j < numJobs; j++) {
+        for (int i = 0; i < jobs[j]->nprocs; i++) {
+            struct process *p = &jobs[j]->procs[i];
+            if (p->pid != pid) {
+                continue;
+            }
+            if (WIFSTOPPED(status)) {
+                p->stopped = true;
+            } else if (WIFCONTINUED(status)) {
+                p->stopped = false;
+            } else {
+                p->exited = true;
+                p->stopped = false;
+                p->status = status;
+                p->usage = *usage;
+                clock_gettime(CLOCK_MONOTONIC, &p->end);
+            }
+            return;
+        }
+    }
+}
+
+static void onSigchld(int sig)
+{
+    int savedErrno = errno;
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    //wait4 also says what the child used, for time and stats
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        updateProcess(pid, status, &usage);
+    }
+    errno = savedErrno;
+}
+
+//set up reaping and, when reading from a terminal, put the shell in charge of it
+void initJobControl(void)
+{
+    sigemptyset(&sigchldMask);
+    sigaddset(&sigchldMask, SIGCHLD);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSigchld;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    jobControl = isatty(STDIN_FILENO);
+    if (!jobControl) {
+        return;
+    }
+    //wait until the shell is in the foreground before taking the terminal
+    while (tcgetpgrp(STDIN_FILENO) != (shellPgid = getpgrp())) {
+        kill(-shellPgid, SIGTTIN);
+    }
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    setpgid(0, 0);
+    shellPgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shellPgid);
+}
+
+//the signals the shell ignores go back to their defaults in its children
+static void defaultSignals(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGTTIN);
+    sigaddset(set, SIGTTOU);
+}
+
+static bool jobRunning(struct job *job)
+{
+    for (int i = 0; i < job->nprocs; i++) {
+        if (!job->procs[i].exited && !job->procs[i].stopped) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool jobDone(struct job *job)
+{
+    for (int i = 0; i < job->nprocs; i++) {
+        if (!job->procs[i].exited) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//a job's status is its last stage's: its exit status, or 128 + the signal that killed it
+static int jobStatus(struct job *job)
+{
+    int status = job->procs[job->nprocs - 1].status;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static void signalJob(struct job *job, int sig)
+{
+    if (job->pgid > 0) {
+        kill(-job->pgid, sig);
+        return;
+    }
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pid > 0 && !job->procs[i].exited) {
+            kill(job->procs[i].pid, sig);
+        }
+    }
+}
+
+static double seconds(struct timespec from, struct timespec to)
+{
+    return (to.tv_sec - from.tv_sec) + (to.tv_nsec - from.tv_nsec) / 1e9;
+}
+
+//how long a process of job ran; one that never started has no end time and ran for 0 s
+static double processWall(const struct job *job, const struct process *p)
+{
+    return p->end.tv_sec != 0 ? seconds(job->start, p->end) : 0;
+}
+
+//from the start of job to the end of its last process
+static double jobWall(const struct job *job)
+{
+    double wall = 0;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (processWall(job, &job->procs[i]) > wall) {
+            wall = processWall(job, &job->procs[i]);
+        }
+    }
+    return wall;
+}
+
+//print a job the way jobs lists it
+static void printJob(struct job *job)
+{
+    char state[32];
+    if (!jobDone(job)) {
+        strcpy(state, jobRunning(job) ? "Running" : "Stopped");
+    } else {
+        int status = job->procs[job->nprocs - 1].status;
+        if (WIFSIGNALED(status)) {
+            snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(status)));
+        } else if (WEXITSTATUS(status) != 0) {
+            snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(status));
+        } else {
+            strcpy(state, "Done");
+        }
+    }
+    printf("[%d]%c %-24s%s\n", job->id, job == jobs[numJobs - 1] ? '+' : ' ', state, job->line);
+}
+
+//take job out of the table (SIGCHLD blocked); a finished job's resource use is added to the
+//session's totals first, and reported if it was timed
+static void removeJob(struct job *job)
+{
+    if (jobDone(job)) {
+        if (job->timed) {
+            printTimes(job);
+        }
+        jobsRun++;
+        for (int i = 0; i < job->nprocs; i++) {
+            addUsage(&sessionTotals, &job->procs[i].usage);
+        }
+        sessionTotals.wall += jobWall(job);
+    }
+    int j = 0;
+    while (jobs[j] != job) {
+        j++;
+    }
+    memmove(&jobs[j], &jobs[j + 1], (numJobs - j - 1) * sizeof(jobs[0]));
+    numJobs--;
+    for (int i = 0; i < job->nprocs; i++) {
+        free(job->procs[i].name);
+    }
+    free(job->line);
+    free(job->procs);
+    free(job);
+}
+
+//start every stage of a parsed command line as one job; returns NULL (after reporting it and
+//closing the pipes made so far) if the pipes can't be made
+struct job *launchJob(const struct commandLine *cmd, const char *line)
+{
+    int prolen = cmd->nstages;
+    bool background = cmd->background;
+    //create pipes; they are close-on-exec, so a spawned command only keeps the ends it is given
+    int (*fd)[2] = arenaAlloc((prolen - 1) * sizeof(fd[0]));
+    for (int i = 0; i < prolen - 1; i++) {
+        if (pipe2(fd[i], O_CLOEXEC) == -1) {
+            fprintf(stderr, "jsh error: cannot create pipe %d of %d: %s\n", i + 1, prolen - 1, strerror(errno));
+            closeAll(fd, i);
+            return NULL;
+        }
+        //a bigger pipe lets a stage that moves a lot of data do it in fewer, larger reads and writes
+        if (pipeSize > 0) {
+            fcntl(fd[i][1], F_SETPIPE_SZ, pipeSize);
+        }
+    }
+    struct job *job = calloc(1, sizeof(*job));
+    job->line = strndup(line + cmd->start, cmd->end - cmd->start);
+    job->nprocs = prolen;
+    job->procs = calloc(prolen, sizeof(job->procs[0]));
+    job->timed = cmd->timed;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    //a child that exits before it is in the table would be lost, so SIGCHLD waits until the end
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    //run programs in order with pipe()
+    for (int i = 0; i < prolen; i++) {
+        int len = cmd->stages[i].argc;
+        char **args = cmd->stages[i].argv;
+        builtinFunc builtin = findBuiltin(args[0]);
+        //every stage writes to the next pipe except the last one, and reads the previous one except the first one
+        int out = i < prolen - 1 ? fd[i][1] : -1;
+        int in = i > 0 ? fd[i - 1][0] : -1;
+        //the first process started leads the job's process group
+        pid_t pgid = jobControl ? job->pgid : -1;
+        struct process *p = &job->procs[i];
+        if (job->timed) {
+            p->name = strdup(args[0]);
+        }
+        if (builtin == NULL) {
+            p->pid = spawnCommand(&cmd->stages[i], in, out, pgid, !background);
+            //a command that could not be started exits 127 when it wasn't found, 1 when one of its
+            //redirections failed and 126 otherwise, as in sh
+            if (p->pid < 0) {
+                if (p->pid == -1) {
+                    printf("jsh error: Command not found: %s\n", args[0]);
+                }
+                p->status = (p->pid == -1 ? 127 : p->pid == -3 ? 1 : 126) << 8;
+                p->exited = true;
+                continue;
             }
-            //fork new process
-            int rc = fork();
-            if (rc < 0) {
+        } else {
+            //a piped builtin only affects its own process, as in other shells
+            p->pid = fork();
+            if (p->pid < 0) {
                 fprintf(stderr, "fork failed\n");
                 exit(1);
-            } else if (rc == 0) {
-                //child process: every process should redirect the STDOUT except the last one
-                if (i < prolen - 1) {
-                    dup2(fd[i][1], STDOUT_FILENO);
+            } else if (p->pid == 0) {
+                if (pgid >= 0) {
+                    setpgid(0, pgid);
+                    sigset_t defaults;
+                    defaultSignals(&defaults);
+                    for (int sig = 1; sig < NSIG; sig++) {
+                        if (sigismember(&defaults, sig) == 1) {
+                            signal(sig, SIG_DFL);
+                        }
+                    }
                 }
-                //every process should redirect the STDIN except the first one
-                if (i > 0) {
-                    dup2(fd[i - 1][0], STDIN_FILENO);
+                sigprocmask(SIG_SETMASK, &oldMask, NULL);
+                if (out != -1) {
+                    dup2(out, STDOUT_FILENO);
+                }
+                if (in != -1) {
+                    dup2(in, STDIN_FILENO);
                 }
                 closeAll(fd, prolen - 1);
-                if (execvp(args[0], args) == -1) {
-                    exit(127);
+                if (applyRedirects(&cmd->stages[i], NULL) == -1) {
+                    _exit(1);
                 }
-            } else {
-                //parent process
-                child[i] = rc;
-                command[i] = args[0];
-            }
-        }
-        closeAll(fd, prolen - 1);
-        //parent process wait for all the children
-        int finalreturn;
-        for (int i = 0; i < prolen; i++) {
-            int wstatus;
-            waitpid(child[i], &wstatus, 0);
-            int return_value = WEXITSTATUS(wstatus);
-            if (return_value == 127) {
-                printf("jsh error: Command not found: %s\n", command[i]);
-            }
-            if (i == prolen - 1) {
-                finalreturn = return_value;
-            }
-        }       
-        printf("jsh status: %d\n", finalreturn);         
-    }   
-    return 0;
+                int ret = builtin(len, args);
+                fflush(stdout);
+                _exit(ret);
+            }
+            //set here too, so the group exists whichever of the two runs first
+            if (pgid >= 0) {
+                setpgid(p->pid, pgid ? pgid : p->pid);
+            }
+        }
+        if (job->pgid == 0 && jobControl) {
+            job->pgid = p->pid;
+        }
+    }
+    closeAll(fd, prolen - 1);
+    //the new job's id is one more than the highest in use
+    job->id = numJobs > 0 ? jobs[numJobs - 1]->id + 1 : 1;
+    jobs = realloc(jobs, (numJobs + 1) * sizeof(jobs[0]));
+    jobs[numJobs++] = job;
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return job;
 }
 
-//spilt input to pros[] by |
-int splitPipes(char* input, char *pros[]) 
+//give job the terminal and wait until it exits or stops; returns its status
+int waitForeground(struct job *job)
 {
-    char *arg;
-    int len;
-    for(len = 0; (arg = strsep(&input,"|")) != NULL; len++) {
-        pros[len] = strdup(arg);
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    if (jobControl && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    while (jobRunning(job)) {
+        sigsuspend(&oldMask);
+    }
+    if (jobControl) {
+        tcsetpgrp(STDIN_FILENO, shellPgid);
     }
-    pros[len] = NULL;
-    return len;
+    int status;
+    if (!jobDone(job)) {
+        //stopped: it stays in the table as a background job
+        printf("\n");
+        printJob(job);
+        job->notified = true;
+        status = 128 + SIGTSTP;
+    } else {
+        status = jobStatus(job);
+        //the ^C the terminal echoed is still on the line
+        if (jobControl && status == 128 + SIGINT) {
+            printf("\n");
+        }
+        removeJob(job);
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return status;
 }
 
-//spilt input to args[] by space
-int splitArgs(char* input, char *args[]) 
+//report the background jobs that finished or stopped since the last prompt
+void reportJobs(void)
 {
-    char *arg;
-    int len;
-    for(len = 0; (arg = strsep(&input," \t")) != NULL; len++) {
-        if(*arg == '\0') {
-            len--;
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    for (int j = 0; j < numJobs; j++) {
+        struct job *job = jobs[j];
+        if (jobDone(job)) {
+            printJob(job);
+            removeJob(job);
+            j--;
+        } else if (!jobRunning(job) && !job->notified) {
+            printJob(job);
+            job->notified = true;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+//start a command with posix_spawn, which doesn't copy the shell's page tables like fork does,
+//with in and out (unless -1) as its STDIN and STDOUT and then its redirections, in process group
+//pgid (a new one if 0, the shell's if -1) which takes the terminal when it is a foreground job;
+//returns its PID, -1 if it wasn't found, -3 if a redirection failed or -2 if it can't be run for
+//another reason (the last two reported here)
+int spawnCommand(const struct stage *st, int in, int out, pid_t pgid, bool foreground)
+{
+    char **args = st->argv;
+    if (checkRedirects(st) == -1) {
+        return -3;
+    }
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    //SIGCHLD is blocked while a job starts; the command gets the mask the shell normally has
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (pgid >= 0) {
+        sigset_t defaults;
+        defaultSignals(&defaults);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP;
+#if __GLIBC_PREREQ(2, 35)
+        //take the terminal before exec, or the command could be stopped reading it before waitForeground gives it
+        if (foreground) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    if (out != -1) {
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    }
+    if (in != -1) {
+        posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    }
+    for (int i = 0; i < st->nredirs; i++) {
+        const struct redirect *r = &st->redirs[i];
+        if (r->flags == -1) {
+            posix_spawn_file_actions_adddup2(&actions, r->dupFd, r->fd);
+        } else {
+            posix_spawn_file_actions_addopen(&actions, r->fd, r->file, r->flags, 0666);
+        }
+    }
+    extern char **environ;
+    pid_t pid;
+    int err;
+    //a name with a / in it is a path already; any other name is looked up in PATH (through the cache)
+    if (strchr(args[0], '/') != NULL) {
+        err = posix_spawn(&pid, args[0], &actions, &attr, args, environ);
+    } else {
+        const char *path = hashLookup(args[0]);
+        err = path != NULL ? posix_spawn(&pid, path, &actions, &attr, args, environ) : ENOENT;
+        //the command may have moved since it was cached: search PATH again once
+        if (err != 0 && path != NULL) {
+            hashForget(args[0]);
+            path = hashLookup(args[0]);
+            err = path != NULL ? posix_spawn(&pid, path, &actions, &attr, args, environ) : ENOENT;
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err == 0) {
+        return pid;
+    }
+    //a missing command is reported as not found by the caller
+    if (err == ENOENT) {
+        return -1;
+    }
+    //checkRedirects passed, so the exec most likely failed, but posix_spawn can't say which did
+    if (st->nredirs > 0) {
+        fprintf(stderr, "jsh error: cannot run %s or set up its redirections: %s\n", args[0], strerror(err));
+    } else {
+        fprintf(stderr, "jsh error: cannot run %s: %s\n", args[0], strerror(err));
+    }
+    return -2;
+}
+
+//check, without opening anything, that the redirections of a stage about to be spawned can be
+//set up: each descriptor duplicated is open (in the shell or by an earlier redirection) and each
+//file can be opened, or created in its directory. returns 0, or -1 after reporting the first failure
+int checkRedirects(const struct stage *st)
+{
+    bool redirected[10] = {false};
+    for (int i = 0; i < st->nredirs; i++) {
+        const struct redirect *r = &st->redirs[i];
+        if (r->flags == -1) {
+            if (!redirected[r->dupFd] && fcntl(r->dupFd, F_GETFD) == -1) {
+                fprintf(stderr, "jsh error: %d: %s\n", r->dupFd, strerror(errno));
+                return -1;
+            }
+            redirected[r->fd] = true;
             continue;
         }
-        args[len] = strdup(arg);
+        int mode = (r->flags & O_ACCMODE) == O_RDONLY ? R_OK : W_OK;
+        struct stat sb;
+        int ok = access(r->file, mode);
+        if (ok == 0 && mode == W_OK && stat(r->file, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            errno = EISDIR;
+            ok = -1;
+        } else if (ok == -1 && errno == ENOENT && (r->flags & O_CREAT)) {
+            //a new file needs a directory it can be added to
+            const char *slash = strrchr(r->file, '/');
+            char *dir = slash == NULL ? strdup(".") : slash == r->file ? strdup("/") : strndup(r->file, slash - r->file);
+            ok = access(dir, W_OK | X_OK);
+            free(dir);
+        }
+        if (ok == -1) {
+            fprintf(stderr, "jsh error: %s: %s\n", r->file, strerror(errno));
+            return -1;
+        }
+        redirected[r->fd] = true;
+    }
+    return 0;
+}
+
+//apply the redirections of a stage that runs in this process; with saved, the descriptors they
+//replace are kept there for restoreRedirects. returns 0, or -1 after reporting a failure
+int applyRedirects(const struct stage *st, int saved[])
+{
+    for (int i = 0; i < st->nredirs; i++) {
+        const struct redirect *r = &st->redirs[i];
+        if (saved != NULL) {
+            fflush(stdout);
+            saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+        }
+        int fd = r->flags == -1 ? r->dupFd : open(r->file, r->flags | O_CLOEXEC, 0666);
+        if (fd == -1 || dup2(fd, r->fd) == -1) {
+            fprintf(stderr, "jsh error: %s: %s\n", r->flags == -1 ? "redirection" : r->file, strerror(errno));
+            if (saved != NULL) {
+                //only the ones applied so far are undone
+                struct stage applied = *st;
+                applied.nredirs = i + 1;
+                restoreRedirects(&applied, saved);
+            }
+            return -1;
+        }
+        if (r->flags != -1) {
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+//put back the descriptors applyRedirects saved, last one first
+void restoreRedirects(const struct stage *st, int saved[])
+{
+    for (int i = st->nredirs - 1; i >= 0; i--) {
+        if (saved[i] == -1) {
+            close(st->redirs[i].fd);
+        } else {
+            dup2(saved[i], st->redirs[i].fd);
+            close(saved[i]);
+        }
     }
-    args[len] = NULL;
-    return len;
+}
+
+static struct hashEntry *hashTable[HASH_BUCKETS];
+//the PATH the cached locations were found in
+static char *hashPath = NULL;
+
+static struct hashEntry **hashBucket(const char *name)
+{
+    unsigned int h = 5381;
+    for (const char *c = name; *c != '\0'; c++) {
+        h = h * 33 + (unsigned char)*c;
+    }
+    return &hashTable[h % HASH_BUCKETS];
+}
+
+//search PATH for an executable file called name; returns it in a malloc'ed string, or NULL
+static char *searchPath(const char *name, const char *path)
+{
+    size_t nameLen = strlen(name);
+    const char *dir = path;
+    while (true) {
+        const char *end = strchrnul(dir, ':');
+        size_t dirLen = end - dir;
+        char *full = malloc(dirLen + nameLen + 2);
+        //an empty entry in PATH is the current directory
+        if (dirLen == 0) {
+            strcpy(full, name);
+        } else {
+            memcpy(full, dir, dirLen);
+            full[dirLen] = '/';
+            strcpy(full + dirLen + 1, name);
+        }
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            return full;
+        }
+        free(full);
+        if (*end == '\0') {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+//the current PATH; all cached locations are dropped when it isn't the one they were found in
+static const char *hashCheckPath(void)
+{
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+    if (hashPath == NULL || strcmp(hashPath, path) != 0) {
+        hashReset();
+        hashPath = strdup(path);
+    }
+    return path;
+}
+
+//the cache entry of the command name, searching PATH only if it isn't cached; NULL if it isn't found
+static struct hashEntry *hashFind(const char *name)
+{
+    const char *path = hashCheckPath();
+    struct hashEntry **bucket = hashBucket(name);
+    for (struct hashEntry *e = *bucket; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    char *full = searchPath(name, path);
+    if (full == NULL) {
+        return NULL;
+    }
+    struct hashEntry *e = malloc(sizeof(*e));
+    e->name = strdup(name);
+    e->path = full;
+    e->hits = 0;
+    e->next = *bucket;
+    *bucket = e;
+    return e;
+}
+
+//the full path of the command name, or NULL if it isn't in PATH
+const char *hashLookup(const char *name)
+{
+    struct hashEntry *e = hashFind(name);
+    if (e == NULL) {
+        return NULL;
+    }
+    e->hits++;
+    return e->path;
+}
+
+//drop the cached location of name
+void hashForget(const char *name)
+{
+    for (struct hashEntry **e = hashBucket(name); *e != NULL; e = &(*e)->next) {
+        if (strcmp((*e)->name, name) == 0) {
+            struct hashEntry *gone = *e;
+            *e = gone->next;
+            free(gone->name);
+            free(gone->path);
+            free(gone);
+            return;
+        }
+    }
+}
+
+//drop all cached locations
+void hashReset(void)
+{
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (hashTable[i] != NULL) {
+            struct hashEntry *gone = hashTable[i];
+            hashTable[i] = gone->next;
+            free(gone->name);
+            free(gone->path);
+            free(gone);
+        }
+    }
+    free(hashPath);
+    hashPath = NULL;
 }
 
 //close all the file descriptor created by pipe
@@ -126,4 +1066,352 @@ void closeAll(int fd[][2], int len)
         close(fd[i][0]);
         close(fd[i][1]);
     }
-}
\ No newline at end of file
+}
+//find the builtin called name, or NULL if it is a program
+builtinFunc findBuiltin(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return builtins[i].func;
+        }
+    }
+    return NULL;
+}
+
+//cd [dir]: change the working directory, to $HOME without an argument
+int builtinCd(int argc, char *args[])
+{
+    const char *dir = argc > 1 ? args[1] : getenv("HOME");
+    if (dir == NULL) {
+        fprintf(stderr, "jsh error: cd: HOME not set\n");
+        return 1;
+    }
+    if (chdir(dir) == -1) {
+        fprintf(stderr, "jsh error: cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+//pwd: print the working directory
+int builtinPwd(int argc, char *args[])
+{
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        fprintf(stderr, "jsh error: pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    free(cwd);
+    return 0;
+}
+
+//echo [-n] [args...]: print the arguments separated by spaces
+int builtinEcho(int argc, char *args[])
+{
+    int first = 1;
+    bool newline = true;
+    if (argc > 1 && strcmp(args[1], "-n") == 0) {
+        newline = false;
+        first = 2;
+    }
+    for (int i = first; i < argc; i++) {
+        fputs(args[i], stdout);
+        if (i < argc - 1) {
+            putchar(' ');
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+int builtinTrue(int argc, char *args[])
+{
+    return 0;
+}
+
+int builtinFalse(int argc, char *args[])
+{
+    return 1;
+}
+
+//export [name=value...]: set environment variables, or list them without arguments
+int builtinExport(int argc, char *args[])
+{
+    extern char **environ;
+    if (argc == 1) {
+        for (char **env = environ; *env != NULL; env++) {
+            printf("export %s\n", *env);
+        }
+        return 0;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        char *eq = strchr(args[i], '=');
+        //export name without a value keeps the variable as it is
+        if (eq == NULL) {
+            continue;
+        }
+        *eq = '\0';
+        if (eq == args[i] || setenv(args[i], eq + 1, 1) == -1) {
+            fprintf(stderr, "jsh error: export: invalid name: %s\n", args[i]);
+            ret = 1;
+        }
+        *eq = '=';
+    }
+    return ret;
+}
+
+//exit [status]: leave the shell (or just the pipeline stage it runs in)
+int builtinExit(int argc, char *args[])
+{
+    fflush(stdout);
+    exit(argc > 1 ? atoi(args[1]) : 0);
+}
+
+//hash [-r] [name...]: list the cached command locations, forget them all (-r) or look up names
+int builtinHash(int argc, char *args[])
+{
+    if (argc == 1) {
+        hashCheckPath();
+        bool empty = true;
+        for (int i = 0; i < HASH_BUCKETS; i++) {
+            for (struct hashEntry *e = hashTable[i]; e != NULL; e = e->next) {
+                if (empty) {
+                    printf("hits\tcommand\n");
+                    empty = false;
+                }
+                printf("%4d\t%s\n", e->hits, e->path);
+            }
+        }
+        if (empty) {
+            printf("hash: hash table empty\n");
+        }
+        return 0;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(args[i], "-r") == 0) {
+            hashReset();
+        } else if (findBuiltin(args[i]) == NULL && strchr(args[i], '/') == NULL) {
+            //looking a name up doesn't count as a hit
+            if (hashFind(args[i]) == NULL) {
+                fprintf(stderr, "jsh error: hash: %s: not found\n", args[i]);
+                ret = 1;
+            }
+        }
+    }
+    return ret;
+}
+
+//the job a jobs/fg/bg argument names (%n or n), or the latest job without one; NULL if there is none
+static struct job *findJob(const char *spec)
+{
+    if (spec == NULL) {
+        return numJobs > 0 ? jobs[numJobs - 1] : NULL;
+    }
+    int id = atoi(spec[0] == '%' ? spec + 1 : spec);
+    for (int j = 0; j < numJobs; j++) {
+        if (jobs[j]->id == id) {
+            return jobs[j];
+        }
+    }
+    return NULL;
+}
+
+//jobs: list the jobs; finished ones are listed for the last time
+int builtinJobs(int argc, char *args[])
+{
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    for (int j = 0; j < numJobs; j++) {
+        printJob(jobs[j]);
+        if (!jobRunning(jobs[j])) {
+            jobs[j]->notified = true;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    reportJobs();
+    return 0;
+}
+
+//fg [%n]: continue a job in the foreground and wait for it
+int builtinFg(int argc, char *args[])
+{
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    struct job *job = findJob(argc > 1 ? args[1] : NULL);
+    if (job == NULL) {
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        fprintf(stderr, "jsh error: fg: no such job\n");
+        return 1;
+    }
+    printf("%s\n", job->line);
+    fflush(stdout);
+    if (jobControl && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    for (int i = 0; i < job->nprocs; i++) {
+        job->procs[i].stopped = false;
+    }
+    job->notified = false;
+    signalJob(job, SIGCONT);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return waitForeground(job);
+}
+
+//bg [%n]: continue a stopped job in the background
+int builtinBg(int argc, char *args[])
+{
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    struct job *job = findJob(argc > 1 ? args[1] : NULL);
+    int ret = 0;
+    if (job == NULL) {
+        fprintf(stderr, "jsh error: bg: no such job\n");
+        ret = 1;
+    } else {
+        for (int i = 0; i < job->nprocs; i++) {
+            job->procs[i].stopped = false;
+        }
+        job->notified = false;
+        signalJob(job, SIGCONT);
+        printf("[%d] %s &\n", job->id, job->line);
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return ret;
+}
+
+//wait [%n|pid...]: wait for the given jobs (all running jobs without arguments) to finish;
+//returns the status of the last one given
+int builtinWait(int argc, char *args[])
+{
+    sigset_t oldMask;
+    sigprocmask(SIG_BLOCK, &sigchldMask, &oldMask);
+    int ret = 0;
+    if (argc == 1) {
+        for (int j = 0; j < numJobs; j++) {
+            while (jobRunning(jobs[j])) {
+                sigsuspend(&oldMask);
+            }
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        struct job *job = NULL;
+        if (args[i][0] == '%') {
+            job = findJob(args[i]);
+        } else {
+            //a pid names the job it is part of
+            pid_t pid = atoi(args[i]);
+            for (int j = 0; j < numJobs && job == NULL; j++) {
+                for (int k = 0; k < jobs[j]->nprocs; k++) {
+                    if (jobs[j]->procs[k].pid == pid) {
+                        job = jobs[j];
+                    }
+                }
+            }
+        }
+        if (job == NULL) {
+            fprintf(stderr, "jsh error: wait: %s: no such job\n", args[i]);
+            ret = 127;
+            continue;
+        }
+        while (jobRunning(job)) {
+            sigsuspend(&oldMask);
+        }
+        ret = jobDone(job) ? jobStatus(job) : 128 + SIGTSTP;
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return ret;
+}
+
+//pipesize [bytes]: show or set the buffer size of the pipes between stages (0 for the default);
+//the kernel rounds it up to a power of two of pages and limits it to /proc/sys/fs/pipe-max-size
+int builtinPipesize(int argc, char *args[])
+{
+    if (argc == 1) {
+        printf("%d\n", pipeSize);
+        return 0;
+    }
+    int size = atoi(args[1]);
+    if (size <= 0) {
+        pipeSize = 0;
+        return 0;
+    }
+    //try it on a pipe of our own to find the size the kernel will actually give
+    int fd[2];
+    if (pipe(fd) == -1) {
+        fprintf(stderr, "jsh error: pipesize: %s\n", strerror(errno));
+        return 1;
+    }
+    int actual = fcntl(fd[1], F_SETPIPE_SZ, size);
+    int err = errno;
+    close(fd[0]);
+    close(fd[1]);
+    if (actual == -1) {
+        fprintf(stderr, "jsh error: pipesize: %d: %s\n", size, strerror(err));
+        return 1;
+    }
+    pipeSize = actual;
+    return 0;
+}
+
+//add one process's resource use to totals
+void addUsage(struct usageTotals *totals, const struct rusage *usage)
+{
+    totals->processes++;
+    totals->user += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+    totals->sys += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+    if (usage->ru_maxrss > totals->maxRss) {
+        totals->maxRss = usage->ru_maxrss;
+    }
+    totals->voluntarySwitches += usage->ru_nvcsw;
+    totals->involuntarySwitches += usage->ru_nivcsw;
+}
+
+static void printTimesRow(const char *stage, double wall, const struct usageTotals *t, const char *name)
+{
+    fprintf(stderr, "%-6s %9.3f %9.3f %9.3f %10ld %8ld %8ld  %s\n",
+            stage, wall, t->user, t->sys, t->maxRss, t->voluntarySwitches, t->involuntarySwitches, name);
+}
+
+//report what every stage of a finished job used, and the whole job (on stderr, like time in other shells)
+void printTimes(const struct job *job)
+{
+    fflush(stdout);
+    fprintf(stderr, "%-6s %9s %9s %9s %10s %8s %8s  %s\n",
+            "stage", "wall(s)", "user(s)", "sys(s)", "maxrss(kB)", "vcsw", "ivcsw", "command");
+    struct usageTotals total = {0};
+    for (int i = 0; i < job->nprocs; i++) {
+        const struct process *p = &job->procs[i];
+        struct usageTotals one = {0};
+        addUsage(&one, &p->usage);
+        addUsage(&total, &p->usage);
+        char stage[16];
+        snprintf(stage, sizeof(stage), "%d", i + 1);
+        printTimesRow(stage, processWall(job, p), &one, p->name != NULL ? p->name : "");
+    }
+    printTimesRow("total", jobWall(job), &total, job->line);
+}
+
+//stats: the resource use of everything the session has run so far
+int builtinStats(int argc, char *args[])
+{
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    printf("jobs finished          %ld\n", jobsRun);
+    printf("processes              %ld\n", sessionTotals.processes);
+    printf("builtins in the shell  %ld\n", builtinsRun);
+    printf("job wall time          %.3f s\n", sessionTotals.wall);
+    printf("job user time          %.3f s\n", sessionTotals.user);
+    printf("job system time        %.3f s\n", sessionTotals.sys);
+    printf("largest max rss        %ld kB\n", sessionTotals.maxRss);
+    printf("voluntary switches     %ld\n", sessionTotals.voluntarySwitches);
+    printf("involuntary switches   %ld\n", sessionTotals.involuntarySwitches);
+    printf("shell user time        %.3f s\n", self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6);
+    printf("shell system time      %.3f s\n", self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6);
+    printf("shell max rss          %ld kB\n", self.ru_maxrss);
+    return 0;
+}